@@ -23,4 +23,6 @@ void admin_pause_done(void);
 bool admin_flush(PgSocket *admin, PktBuf *buf, const char *desc) /* _MUSTCHECK */;
 bool admin_ready(PgSocket *admin, const char *desc)  _MUSTCHECK;
 void admin_handle_cancel(PgSocket *client);
+void admin_stream_abort(PgSocket *admin);
+void admin_stream_forget_pool(PgPool *pool);
 
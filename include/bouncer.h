@@ -63,6 +63,9 @@ typedef struct PgDatabase PgDatabase;
 typedef struct PgPool PgPool;
 typedef struct PgStats PgStats;
 typedef struct PgAddr PgAddr;
+typedef struct PgHost PgHost;
+typedef struct CacheEntry CacheEntry;
+typedef struct AuthCacheEntry AuthCacheEntry;
 typedef enum SocketState SocketState;
 typedef struct PktHdr PktHdr;
 
@@ -89,6 +92,16 @@ extern int cf_sbuf_len;
 #include "stats.h"
 #include "takeover.h"
 #include "janitor.h"
+#include "hosts.h"
+#include "dnslookup.h"
+#include "cache.h"
+#include "authwatch.h"
+#include "authdb.h"
+#include "authquery.h"
+#include "metrics.h"
+#include "shmstats.h"
+#include "trace.h"
+#include "probes.h"
 
 /* to avoid allocations will use static buffers */
 #define MAX_DBNAME	64
@@ -112,6 +125,12 @@ extern int cf_sbuf_len;
 #define POOL_TX		1
 #define POOL_STMT	2
 
+/* priority classes of waiting clients, see priority_users/batch_users */
+#define WAIT_PRIORITY	0
+#define WAIT_NORMAL	1
+#define WAIT_BATCH	2
+#define WAIT_CLASSES	3
+
 /* old style V2 header: len:4b code:4b */
 #define OLD_HEADER_LEN	8
 /* new style V3 packet header len - type:1b, len:4b */ 
@@ -128,14 +147,46 @@ struct PgAddr {
 	bool is_unix;
 };
 
+/*
+ * Backend host, shared between all databases and pools that point to it.
+ */
+struct PgHost {
+	List head;
+	char name[MAX_HOSTNAME];	/* as given in host= */
+	PgAddr addr;			/* resolved address for connect(), INADDR_NONE if not yet */
+
+	bool is_ip:1;		/* name is ip-address, no lookup needed */
+	bool dns_pending:1;	/* lookup in progress */
+	bool dns_failed:1;	/* last lookup failed */
+	usec_t dns_expire;	/* when to look up again, 0 means asap */
+
+	int refcount;		/* databases and server connections using it */
+	int conn_count;		/* server connections, including ones in login */
+	int active_count;	/* servers linked to client, requests in flight */
+
+	int state;		/* HOST_UP, HOST_SUSPECT or HOST_DOWN */
+	int fail_count;		/* connect failures in row */
+	usec_t retry_time;	/* when down host may be tried again */
+};
+
 /*
  * Stats, kept per-pool.
  */
+/* start of query text kept for slow query log */
+#define SLOW_QUERY_TEXT	80
+
+/* snapshots kept for SHOW STATS <window>, see stats.c */
+#define STATS_HIST_LEN	24
+
 struct PgStats {
 	uint64_t request_count;
 	uint64_t server_bytes;
 	uint64_t client_bytes;
 	usec_t query_time;	/* total req time in us */
+	uint64_t xact_count;	/* transactions finished */
+	uint64_t query_count;	/* queries finished */
+	usec_t xact_time;	/* total time servers were held by xacts */
+	usec_t wait_time;	/* total time clients waited for server */
 };
 
 /*
@@ -164,9 +215,17 @@ struct PgPool {
 	StatList tested_server_list;	/* server in testing process */
 	StatList new_server_list;	/* servers in login phase */
 
+	/* first client of each priority class in waiting_client_list */
+	PgSocket *wait_first[WAIT_CLASSES];
+	int wait_count[WAIT_CLASSES];
+
+	/* fires when oldest waiting client hits query_wait_timeout */
+	struct event wait_timer;
+
 	PgStats stats;
 	PgStats newer_stats;
 	PgStats older_stats;
+	PgStats stats_hist[STATS_HIST_LEN];	/* recent snapshots of stats */
 
 	/* database info to be sent to client */
 	uint8_t welcome_msg[256];	/* ServerParams without VarCache ones */
@@ -176,11 +235,22 @@ struct PgPool {
 
 	usec_t last_lifetime_disconnect;/* last time when server_lifetime was applied */
 
+	int loop_budget;		/* bytes pool sockets can still read in this loop */
+
+	/* result cache stats */
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	int cache_entries;
+	int cache_bytes;
+
 	/* if last connect failed, there should be delay before next */
 	usec_t last_connect_time;
+	PgHost *last_connect_host;	/* host of last attempt, only compared */
 	unsigned last_connect_failed:1;
 
 	unsigned welcome_msg_ready:1;
+	unsigned wait_timer_set:1;
+	unsigned has_routed:1;		/* clients with it as home_pool have logged in */
 };
 
 #define pool_server_count(pool) ( \
@@ -211,6 +281,7 @@ struct PgUser {
 	Node tree_node;		/* used to attach user to tree */
 	char name[MAX_USERNAME];
 	char passwd[MAX_PASSWORD];
+	bool from_query;	/* password comes from auth_query, not auth_file */
 };
 
 /*
@@ -218,6 +289,7 @@ struct PgUser {
  */
 struct PgDatabase {
 	List head;
+	Node tree_node;		/* entry in database_tree */
 	char name[MAX_DBNAME];	/* db name for clients */
 
 	bool db_paused;		/* PAUSE <db>; was issued */
@@ -230,12 +302,20 @@ struct PgDatabase {
 
 	PgUser *forced_user;	/* if not NULL, the user/psw is forced */
 
-	PgAddr addr;		/* address prepared for connect() */
+	PgAddr addr;		/* address prepared for connect(), if unix socket */
 	char unix_socket_dir[UNIX_PATH_MAX]; /* custom unix socket dir */
 
+	PgHost *hosts[MAX_DB_HOSTS];	/* TCP hosts from host= list, then standby_host= */
+	int host_count;		/* total count of hosts */
+	int primary_count;	/* hosts from host= */
+	unsigned host_rr;	/* where pick_host() starts next search */
+
 	int max_client_conn;	/* max client connections in one pool */
 	int pool_size;		/* max server connections in one pool */
 	int res_pool_size;	/* additional server connections in case of trouble */
+	int budget_weight;	/* share of pool_loop_budget for pools of this db */
+
+	char replica_name[MAX_DBNAME];	/* read-only transactions go to this db */
 
 	const char *dbname;	/* server-side name, pointer to inside startup_msg */
 
@@ -257,15 +337,25 @@ struct PgSocket {
 	PgPool *pool;		/* parent pool, if NULL not yet assigned */
 
 	PgUser *auth_user;	/* presented login, for client it may differ from pool->user */
+	PgPool *home_pool;	/* client: pool for read-write work, if db has replica */
+	PgHost *host;		/* server: backend host it is connected to */
+	CacheEntry *cache_fill;	/* server: result being captured for cache */
+	AuthCacheEntry *auth_lookup; /* client: pending auth_query answer */
 
 	SocketState state:8;	/* this also specifies socket location */
+	uint8_t tx_state;	/* server: status from last ReadyForQuery */
+	int rfq_pending;	/* server: ReadyForQuery pkts client still waits for */
 
 	bool ready:1;		/* server: accepts new query */
 	bool close_needed:1;	/* server: this socket must be closed ASAP */
 	bool setting_vars:1;	/* server: setting client vars */
 	bool exec_on_connect:1;	/* server: executing connect_query */
+	bool abort_tx:1;	/* server: rolling back tx under statement pooling */
 
 	bool wait_for_welcome:1;/* client: no server yet in pool, cannot send welcome msg */
+	bool wait_for_user:1;	/* client: waits for auth_query answer on auth pool */
+	unsigned wait_class:2;	/* client: priority in waiting_client_list */
+	bool skip_until_sync:1;	/* client: drop extended-protocol pkts until Sync */
 
 	bool suspended:1;	/* client/server: if the socket is suspended */
 
@@ -276,6 +366,12 @@ struct PgSocket {
 	usec_t connect_time;	/* when connection was made */
 	usec_t request_time;	/* last activity time */
 	usec_t query_start;	/* query start moment */
+	usec_t cur_query_start;	/* client: when query waiting for ReadyForQuery started */
+	usec_t wait_start;	/* client: when it started waiting for server */
+	usec_t xact_start;	/* client: when current transaction got server */
+
+	PgStats stats;		/* client: load generated by this connection */
+	char query_text[SLOW_QUERY_TEXT]; /* client: current query, if slow log is on */
 
 	uint8_t cancel_key[BACKENDKEY_LEN]; /* client: generated, server: remote */
 	PgAddr remote_addr;	/* ip:port for remote endpoint */
@@ -310,6 +406,8 @@ extern char *cf_syslog_facility;
 extern char *cf_unix_socket_dir;
 extern char *cf_listen_addr;
 extern int cf_listen_port;
+extern char *cf_metrics_addr;
+extern int cf_metrics_port;
 
 extern int cf_pool_mode;
 extern int cf_max_client_conn;
@@ -329,13 +427,21 @@ extern char * cf_server_check_query;
 extern usec_t cf_server_check_delay;
 extern usec_t cf_server_connect_timeout;
 extern usec_t cf_server_login_retry;
+extern usec_t cf_dns_max_ttl;
 extern usec_t cf_query_timeout;
+extern usec_t cf_query_wait_timeout;
+extern int cf_query_wait_shed;
 extern usec_t cf_client_idle_timeout;
 extern usec_t cf_client_login_timeout;
 extern int cf_server_round_robin;
 
 extern int cf_auth_type;
 extern char *cf_auth_file;
+extern char *cf_auth_user;
+extern char *cf_auth_query;
+extern usec_t cf_auth_cache_ttl;
+extern usec_t cf_auth_cache_negative_ttl;
+extern int cf_auth_cache_size;
 
 extern char *cf_logfile;
 extern char *cf_pidfile;
@@ -344,13 +450,23 @@ extern char *cf_ignore_startup_params;
 
 extern char *cf_admin_users;
 extern char *cf_stats_users;
+extern char *cf_priority_users;
+extern char *cf_batch_users;
+extern char *cf_local_queries;
+extern char *cf_cache_queries;
+extern usec_t cf_cache_ttl;
+extern int cf_cache_max_size;
 extern int cf_stats_period;
+extern char *cf_stats_shm_file;
+extern int cf_trace_size;
+extern char *cf_trace_file;
 
 extern int cf_pause_mode;
 extern int cf_shutdown;
 extern int cf_reboot;
 
 extern int cf_sbuf_loopcnt;
+extern int cf_pool_loop_budget;
 extern int cf_tcp_keepalive;
 extern int cf_tcp_keepcnt;
 extern int cf_tcp_keepidle;
@@ -361,11 +477,21 @@ extern int cf_tcp_defer_accept;
 extern int cf_log_connections;
 extern int cf_log_disconnections;
 extern int cf_log_pooler_errors;
+extern usec_t cf_log_slow_wait;
+extern usec_t cf_log_slow_query;
+extern usec_t cf_log_slow_xact;
+extern int cf_log_slow_limit;
 
 extern ConfElem bouncer_params[];
 
 extern usec_t g_suspend_start;
 
+/* what last config load did */
+extern usec_t g_reload_time;
+extern usec_t g_reload_duration;
+extern int g_reload_changed;
+extern int g_reload_removed;
+
 static inline PgSocket * _MUSTCHECK
 pop_socket(StatList *slist)
 {
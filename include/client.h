@@ -16,7 +16,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/* max length of normalized local_queries entry */
+#define MAX_LOCAL_QUERY	64
+
 bool client_proto(SBuf *sbuf, SBufEvent evtype, MBuf *pkt)  _MUSTCHECK;
-bool set_pool(PgSocket *client, const char *dbname, const char *username) _MUSTCHECK;
+bool set_pool(PgSocket *client, const char *dbname, const char *username, bool read_only, bool takeover) _MUSTCHECK;
 
 
@@ -0,0 +1,53 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* max number of hosts in one host= list */
+#define MAX_DB_HOSTS	16
+
+/* max length of host name */
+#define MAX_HOSTNAME	128
+
+/* host health states */
+#define HOST_UP		0
+#define HOST_SUSPECT	1	/* server connection crashed */
+#define HOST_DOWN	2	/* connect failed, wait until retry_time */
+
+/* cap of exponential backoff, as shift of server_login_retry */
+#define HOST_MAX_BACKOFF_SHIFT	5
+
+extern StatList host_list;
+
+void init_hosts(void);
+
+PgHost *host_get(const char *name, int port, in_addr_t addr) _MUSTCHECK;
+void host_unref(PgHost *host);
+void host_set_addr(PgHost *host, in_addr_t addr);
+bool host_resolved(const PgHost *host);
+bool hosts_unresolved(const PgDatabase *db);
+
+PgHost *pick_host(PgDatabase *db);
+bool host_better(const PgHost *a, const PgHost *b);
+
+void host_server_add(PgHost *host, PgSocket *server);
+void host_server_drop(PgSocket *server);
+
+void host_failed(PgSocket *server);
+void host_crashed(PgHost *host);
+void host_ok(PgHost *host);
+const char *host_state_name(const PgHost *host);
+
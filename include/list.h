@@ -110,6 +110,14 @@ static inline List *list_first(const List *list)
 	return list->next;
 }
 
+/* return last elem in list */
+static inline List *list_last(const List *list)
+{
+	if (list_empty(list))
+		return NULL;
+	return list->prev;
+}
+
 /* put all elems in one list in the start of another list */
 static inline void list_prepend_list(List *src, List *dst)
 {
@@ -265,6 +273,11 @@ static inline List *statlist_first(const StatList *list)
 	return list_first(&list->head);
 }
 
+static inline List *statlist_last(const StatList *list)
+{
+	return list_last(&list->head);
+}
+
 static inline bool statlist_empty(const StatList *list)
 {
 	return list_empty(&list->head);
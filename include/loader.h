@@ -70,6 +70,24 @@ bool set_config_param(ConfElem *elem_list, const char *key, const char *val, boo
 void parse_database(char *name, char *connstr);
 
 /* user file parsing */
+typedef struct AuthEntry {
+	const char *name;
+	const char *passwd;
+	int line;
+} AuthEntry;
+
+/* parsed auth file, sorted by name */
+typedef struct AuthList {
+	char *buf;		/* file contents, entries point into it */
+	AuthEntry *list;
+	int count;
+	const char *error;	/* parse problem, if buf is NULL load failed */
+	bool compiled;		/* file is in compiled format, nothing parsed */
+} AuthList;
+
+AuthList *parse_auth_file(const char *fn);
+bool apply_auth_list(const char *fn, AuthList *lst);
+void free_auth_list(AuthList *lst);
 bool load_auth_file(const char *fn)  /* _MUSTCHECK */;
 bool loader_users_check(void)  /* _MUSTCHECK */;
 
@@ -20,6 +20,7 @@ extern StatList user_list;
 extern Tree user_tree;
 extern StatList pool_list;
 extern StatList database_list;
+extern Tree database_tree;
 extern StatList autodatabase_idle_list;
 extern StatList login_client_list;
 extern ObjectCache *client_cache;
@@ -37,13 +38,18 @@ bool find_server(PgSocket *client)		_MUSTCHECK;
 bool release_server(PgSocket *server)		/* _MUSTCHECK */;
 bool finish_client_login(PgSocket *client)	_MUSTCHECK;
 
-PgSocket * accept_client(int sock, const struct sockaddr_in *addr, bool is_unix) _MUSTCHECK;
+PgSocket * accept_client(int sock, const PgAddr *remote_addr, const PgAddr *local_addr, bool is_unix) _MUSTCHECK;
 void disconnect_server(PgSocket *server, bool notify, const char *reason);
 void disconnect_client(PgSocket *client, bool notify, const char *reason);
 
 PgDatabase * add_database(const char *name) _MUSTCHECK;
 PgDatabase *register_auto_database(const char *name);
+void reset_pool_budget(PgPool *pool);
+PgSocket *oldest_waiting_client(PgPool *pool);
+void stop_wait_timer(PgPool *pool);
+void reset_wait_timers(void);
 PgUser * add_user(const char *name, const char *passwd) _MUSTCHECK;
+PgUser * insert_user(const char *name, const char *passwd, List *pos) _MUSTCHECK;
 PgUser * force_user(PgDatabase *db, const char *username, const char *passwd) _MUSTCHECK;
 
 void accept_cancel_request(PgSocket *req);
@@ -61,12 +67,16 @@ bool use_server_socket(int fd, PgAddr *addr, const char *dbname, const char *use
 void activate_client(PgSocket *client);
 
 void change_client_state(PgSocket *client, SocketState newstate);
+void switch_client_pool(PgSocket *client, PgPool *pool);
 void change_server_state(PgSocket *server, SocketState newstate);
 
 int get_active_client_count(void);
 int get_active_server_count(void);
 
 void tag_database_dirty(PgDatabase *db);
+void tag_host_dirty(PgHost *host);
+void adopt_host_servers(PgHost *host);
+void kill_unresolved_logins(void);
 void for_each_server(PgPool *pool, void (*func)(PgSocket *sk));
 
 void reuse_just_freed_objects(void);
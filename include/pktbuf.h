@@ -21,6 +21,10 @@
  */
 
 typedef struct PktBuf PktBuf;
+
+/* put next chunk into stream buffer, buf is NULL if sending failed */
+typedef bool (*pktbuf_refill_f)(PktBuf *buf, void *arg);
+
 struct PktBuf {
 	uint8_t *buf;
 	int buf_len;
@@ -30,6 +34,9 @@ struct PktBuf {
 	int send_pos;
 	struct event *ev;
 
+	pktbuf_refill_f refill;
+	void *refill_arg;
+
 	unsigned failed:1;
 	unsigned sending:1;
 	unsigned fixed_buf:1;
@@ -40,12 +47,15 @@ struct PktBuf {
  */
 PktBuf *pktbuf_dynamic(int start_len)	_MUSTCHECK;
 void pktbuf_static(PktBuf *buf, uint8_t *data, int len);
+void pktbuf_free(PktBuf *buf);
 
 /*
  * sending
  */
 bool pktbuf_send_immidiate(PktBuf *buf, PgSocket *sk)	_MUSTCHECK;
 bool pktbuf_send_queued(PktBuf *buf, PgSocket *sk)  _MUSTCHECK;
+bool pktbuf_send_stream(PktBuf *buf, PgSocket *sk, pktbuf_refill_f refill, void *arg)  _MUSTCHECK;
+void pktbuf_cancel(PktBuf *buf);
 
 /*
  * low-level ops
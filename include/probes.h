@@ -0,0 +1,64 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Static probes for perf, SystemTap and bpftrace.
+ *
+ * Compiled in with --enable-dtrace.  Probe is single nop in code, until
+ * tracer attaches to it.  Provider is 'pgbouncer', probe names use
+ * dash in place of double underscore:
+ *
+ *   client__accept(client, is_unix)
+ *   client__login(client, db, user)
+ *   client__wait(client, db, user)	- no free server, client parked
+ *   client__link(client, server)	- server assigned to client
+ *   client__disconnect(client, reason)
+ *   server__connect(server, db, user)	- tcp connection ready
+ *   server__login(server, db, user)	- server ready for queries
+ *   server__release(server, client)	- server unlinked from client
+ *   server__disconnect(server, reason)
+ *
+ * Sockets are PgSocket pointers, same as ptr in SHOW SOCKETS, others
+ * are C strings.
+ */
+
+#ifdef ENABLE_DTRACE
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a) DTRACE_PROBE1(pgbouncer, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(pgbouncer, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(pgbouncer, name, a, b, c)
+
+#else
+
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+
+#endif
+
+#define PROBE_CLIENT_ACCEPT(cl, is_unix)	PROBE2(client__accept, cl, is_unix)
+#define PROBE_CLIENT_LOGIN(cl)			PROBE3(client__login, cl, (cl)->pool->db->name, (cl)->auth_user->name)
+#define PROBE_CLIENT_WAIT(cl)			PROBE3(client__wait, cl, (cl)->pool->db->name, (cl)->pool->user->name)
+#define PROBE_CLIENT_LINK(cl, sv)		PROBE2(client__link, cl, sv)
+#define PROBE_CLIENT_DISCONNECT(cl, reason)	PROBE2(client__disconnect, cl, reason)
+#define PROBE_SERVER_CONNECT(sv)		PROBE3(server__connect, sv, (sv)->pool->db->name, (sv)->pool->user->name)
+#define PROBE_SERVER_LOGIN(sv)			PROBE3(server__login, sv, (sv)->pool->db->name, (sv)->pool->user->name)
+#define PROBE_SERVER_RELEASE(sv, cl)		PROBE2(server__release, sv, cl)
+#define PROBE_SERVER_DISCONNECT(sv, reason)	PROBE2(server__disconnect, sv, reason)
@@ -73,6 +73,8 @@ struct SBuf {
 
 	SBuf *dst;		/* target SBuf for current packet */
 
+	int *budget;		/* per-loop byte budget shared with other sockets, may be NULL */
+
 	IOBuf *io;		/* data buffer, lazily allocated */
 };
 
@@ -0,0 +1,75 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Layout of stats_shm_file.
+ *
+ * The file starts with ShmStatsHeader, followed by max_pools records of
+ * pool_size bytes each, starting at header_size.  Values are in native
+ * byte order.  New fields are only appended, so readers should use the
+ * sizes from header instead of sizeof().  Incompatible changes bump
+ * SHMSTATS_VERSION.
+ *
+ * Writer updates are seqlock-style: seq is odd while update is running.
+ * Reader copies the data, then checks that seq was even and did not
+ * change meanwhile, otherwise retries.  If max_pools grows, the file
+ * has been extended and needs to be mapped again.
+ */
+
+#define SHMSTATS_MAGIC		0x53424750	/* "PGBS" */
+#define SHMSTATS_VERSION	1
+#define SHMSTATS_NAMELEN	64
+
+struct ShmStatsHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;		/* offset of first pool record */
+	uint32_t pool_size;		/* size of one pool record */
+	uint32_t max_pools;		/* records that fit into file */
+	uint32_t pool_count;		/* records in use */
+	volatile uint32_t seq;		/* odd while writer is updating */
+	uint32_t pid;			/* writer process */
+	uint64_t start_time;		/* usec since epoch */
+	uint64_t update_time;		/* usec since epoch */
+};
+
+struct ShmStatsPool {
+	char database[SHMSTATS_NAMELEN];
+	char user[SHMSTATS_NAMELEN];
+	uint64_t request_count;
+	uint64_t client_bytes;
+	uint64_t server_bytes;
+	uint64_t query_time;		/* usec */
+	uint64_t maxwait;		/* usec, oldest waiting client */
+	uint32_t cl_active;
+	uint32_t cl_waiting;
+	uint32_t sv_active;
+	uint32_t sv_idle;
+	uint32_t sv_used;
+	uint32_t sv_tested;
+	uint32_t sv_login;
+	uint32_t reserved;
+	uint64_t xact_count;
+	uint64_t query_count;
+	uint64_t xact_time;		/* usec */
+	uint64_t wait_time;		/* usec */
+};
+
+void shmstats_update(void);
+bool shmstats_show(const char *fn);
+
@@ -17,7 +17,12 @@
  */
 
 void stats_setup(void);
+void log_slow(PgSocket *client, const char *what, usec_t dur);
 
-bool admin_database_stats(PgSocket *client, StatList *pool_list)  _MUSTCHECK;
-bool show_stat_totals(PgSocket *client, StatList *pool_list)  _MUSTCHECK;
+/* longest window for SHOW STATS <seconds> */
+#define STATS_MAX_WINDOW 300
+
+bool admin_database_stats(PgSocket *client, StatList *pool_list, int window)  _MUSTCHECK;
+bool admin_user_stats(PgSocket *client, StatList *user_list, int window)  _MUSTCHECK;
+bool show_stat_totals(PgSocket *client, StatList *pool_list, int window)  _MUSTCHECK;
 
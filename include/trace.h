@@ -0,0 +1,68 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Binary trace of socket events, see trace.c.
+ *
+ * TRACE DUMP writes TraceFileHeader followed by count entries,
+ * oldest first, in native byte order.
+ */
+
+#define TRACE_MAGIC	"PGBTRACE"
+#define TRACE_VERSION	1
+
+struct TraceFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint64_t count;
+};
+
+struct TraceEntry {
+	uint64_t time;		/* usec since epoch, loop time */
+	uint64_t sock;		/* PgSocket address, as ptr in SHOW SOCKETS */
+	uint32_t len;		/* packet length, 0 for other events */
+	uint8_t event;		/* SBufEvent */
+	uint8_t side;		/* 'C' or 'S' */
+	uint8_t pkt_type;	/* packet type for SBUF_EV_READ */
+	uint8_t reserved;
+};
+
+extern struct TraceEntry *trace_ring;
+extern unsigned trace_mask;
+extern unsigned trace_pos;
+
+void trace_setup(void);
+bool admin_show_trace(PgSocket *admin, const char *arg)  _MUSTCHECK;
+bool admin_cmd_trace(PgSocket *admin, const char *arg)  _MUSTCHECK;
+
+/* called for every event from client_proto() and server_proto() */
+static inline void trace_event(PgSocket *sk, char side, SBufEvent ev, const PktHdr *pkt)
+{
+	struct TraceEntry *e;
+
+	if (!trace_ring)
+		return;
+	e = &trace_ring[trace_pos++ & trace_mask];
+	e->time = get_cached_time();
+	e->sock = (uintptr_t)sk;
+	e->event = ev;
+	e->side = side;
+	e->pkt_type = pkt ? pkt_desc(pkt) : 0;
+	e->len = pkt ? pkt->len : 0;
+}
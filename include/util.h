@@ -19,6 +19,7 @@
 /*
  * time tools
  */
+usec_t get_time_usec(void);
 usec_t get_cached_time(void);
 void reset_time_cache(void);
 
@@ -99,13 +100,17 @@ void get_random_bytes(uint8_t *dest, int len);
 
 void socket_set_nonblocking(int fd, int val);
 void tune_socket(int sock, bool is_unix);
+void tune_accepted_socket(int sock, bool is_unix);
 
 bool strlist_contains(const char *liststr, const char *str);
+int normalize_query(char *dst, int dstlen, const char *src, int srclen);
+bool querylist_contains(const char *list, const char *q);
 
 const char *format_date(usec_t uval);
 
 void fill_remote_addr(PgSocket *sk, int fd, bool is_unix);
 void fill_local_addr(PgSocket *sk, int fd, bool is_unix);
+const PgAddr *get_local_addr(PgSocket *sk);
 
 
 void rescue_timers(void);
@@ -3,6 +3,7 @@
 #define VAR_DATESTYLE_LEN	16
 #define VAR_TIMEZONE_LEN	36
 #define VAR_STDSTR_LEN		4
+#define VAR_READONLY_LEN	8
 
 typedef struct VarCache VarCache;
 
@@ -11,11 +12,14 @@ struct VarCache {
 	char datestyle[VAR_DATESTYLE_LEN];
 	char timezone[VAR_TIMEZONE_LEN];
 	char std_strings[VAR_STDSTR_LEN];
+	char read_only[VAR_READONLY_LEN];
 };
 
 bool varcache_set(VarCache *cache, const char *key, const char *value) /* _MUSTCHECK */;
+bool varcache_set_local(VarCache *cache, const char *key, const char *value) /* _MUSTCHECK */;
 bool varcache_apply(PgSocket *server, PgSocket *client, bool *changes_p) _MUSTCHECK;
 void varcache_fill_unset(VarCache *src, PgSocket *dst);
 void varcache_clean(VarCache *cache);
+void varcache_clean_local(VarCache *cache);
 void varcache_add_params(PktBuf *pkt, VarCache *vars);
 
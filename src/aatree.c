@@ -206,7 +206,8 @@ static Node *drop_this_node(Tree *tree, Node *old)
 	}
 
 	/* cleanup for old node */
-	tree->release_cb(old, tree);
+	if (tree->release_cb)
+		tree->release_cb(old, tree);
 	tree->count--;
 
 	return new;
@@ -274,7 +275,8 @@ void tree_walk(Tree *tree, enum TreeWalkType wtype, tree_walker_f walker, void *
 /* walk tree in bottom-up order, so that walker can destroy the nodes */
 void tree_destroy(Tree *tree)
 {
-	walk_sub(tree->root, WALK_POST_ORDER, tree->release_cb, tree);
+	if (tree->release_cb)
+		walk_sub(tree->root, WALK_POST_ORDER, tree->release_cb, tree);
 
 	/* reset tree */
 	tree->root = NIL;
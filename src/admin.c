@@ -28,6 +28,7 @@
 #define WS0	"[ \t\n\r]*"
 #define WS1	"[ \t\n\r]+"
 #define WORD	"([0-9a-z_]+)"
+#define NUMWORD	"([0-9a-z_.]+)"
 #define STRING	"'(([^']*|'')*)'"
 
 /* possible max + 1 */
@@ -38,6 +39,8 @@
 #define CMD_ARG 3
 #define SET_KEY 1
 #define SET_VAL 3
+#define SHOW_NAME 1
+#define SHOW_ARGS 2
 
 typedef bool (*cmd_func_t)(PgSocket *admin, const char *arg);
 struct cmd_lookup {
@@ -51,16 +54,21 @@ static const char cmd_normal_rx[] =
 
 /* SET with simple value */
 static const char cmd_set_word_rx[] =
-"^" WS0 "set" WS1 WORD WS0 "(=|to)" WS0 WORD WS0 "(;" WS0 ")?$";
+"^" WS0 "set" WS1 WORD WS0 "(=|to)" WS0 NUMWORD WS0 "(;" WS0 ")?$";
 
 /* SET with quoted value */
 static const char cmd_set_str_rx[] =
 "^" WS0 "set" WS1 WORD WS0 "(=|to)" WS0 STRING WS0 "(;" WS0 ")?$";
 
+/* SHOW with arguments */
+static const char cmd_show_args_rx[] =
+"^" WS0 "show" WS1 WORD WS1 "([^;]*[^; \t\n\r])" WS0 "(;" WS0 ")?$";
+
 /* compiled regexes */
 static regex_t rc_cmd;
 static regex_t rc_set_word;
 static regex_t rc_set_str;
+static regex_t rc_show_args;
 
 static PgPool *admin_pool;
 
@@ -400,12 +408,34 @@ static bool admin_show_fds(PgSocket *admin, const char *arg)
 	return res;
 }
 
+/* comma-separated host list, with port when it differs from default */
+static const char *format_hosts(char *dst, int dstlen, PgDatabase *db, int first, int last)
+{
+	PgHost *h;
+	int i, len = 0;
+
+	if (first >= last)
+		return NULL;
+	dst[0] = 0;
+	for (i = first; i < last && len < dstlen; i++) {
+		h = db->hosts[i];
+		if (h->addr.port == db->addr.port)
+			len += snprintf(dst + len, dstlen - len,
+					"%s%s", i > first ? "," : "", h->name);
+		else
+			len += snprintf(dst + len, dstlen - len,
+					"%s%s:%d", i > first ? "," : "", h->name, h->addr.port);
+	}
+	return dst;
+}
+
 /* Command: SHOW DATABASES */
 static bool admin_show_databases(PgSocket *admin, const char *arg)
 {
 	PgDatabase *db;
 	List *item;
-	char *host;
+	char hosts[MAX_DB_HOSTS * (MAX_HOSTNAME + 8)];
+	char standby[MAX_DB_HOSTS * (MAX_HOSTNAME + 8)];
 	const char *f_user;
 	PktBuf *buf;
 
@@ -415,28 +445,85 @@ static bool admin_show_databases(PgSocket *admin, const char *arg)
 		return true;
 	}
 
-	pktbuf_write_RowDescription(buf, "ssissii",
+	pktbuf_write_RowDescription(buf, "ssissiis",
 				    "name", "host", "port",
-				    "database", "force_user", "pool_size", "reserve_pool");
+				    "database", "force_user", "pool_size", "reserve_pool",
+				    "standby_host");
 	statlist_for_each(item, &database_list) {
 		db = container_of(item, PgDatabase, head);
 
-		if (!db->addr.is_unix) {
-			host = inet_ntoa(db->addr.ip_addr);
-		} else
-			host = NULL;
-
 		f_user = db->forced_user ? db->forced_user->name : NULL;
-		pktbuf_write_DataRow(buf, "ssissii",
-				     db->name, host, db->addr.port,
+		pktbuf_write_DataRow(buf, "ssissiis",
+				     db->name,
+				     format_hosts(hosts, sizeof(hosts), db, 0, db->primary_count),
+				     db->addr.port,
 				     db->dbname, f_user,
 				     db->pool_size,
-				     db->res_pool_size);
+				     db->res_pool_size,
+				     format_hosts(standby, sizeof(standby), db,
+						  db->primary_count, db->host_count));
+	}
+	admin_flush(admin, buf, "SHOW");
+	return true;
+}
+
+/* Command: SHOW HOSTS */
+static bool admin_show_hosts(PgSocket *admin, const char *arg)
+{
+	PgHost *host;
+	List *item;
+	PktBuf *buf;
+
+	buf = pktbuf_dynamic(256);
+	if (!buf) {
+		admin_error(admin, "no mem");
+		return true;
+	}
+
+	pktbuf_write_RowDescription(buf, "ssiiisi",
+				    "name", "addr", "port",
+				    "sv_count", "sv_active", "state", "fail_count");
+	statlist_for_each(item, &host_list) {
+		host = container_of(item, PgHost, head);
+		pktbuf_write_DataRow(buf, "ssiiisi",
+				     host->name,
+				     host_resolved(host) ? inet_ntoa(host->addr.ip_addr) : NULL,
+				     host->addr.port,
+				     host->conn_count, host->active_count,
+				     host_state_name(host), host->fail_count);
 	}
 	admin_flush(admin, buf, "SHOW");
 	return true;
 }
 
+/* Command: SHOW CACHE */
+static bool admin_show_cache(PgSocket *admin, const char *arg)
+{
+	PgPool *pool;
+	List *item;
+	PktBuf *buf;
+
+	buf = pktbuf_dynamic(256);
+	if (!buf) {
+		admin_error(admin, "no mem");
+		return true;
+	}
+
+	pktbuf_write_RowDescription(buf, "ssiiqq",
+				    "database", "user", "entries",
+				    "bytes", "hits", "misses");
+	statlist_for_each(item, &pool_list) {
+		pool = container_of(item, PgPool, head);
+		if (!pool->cache_entries && !pool->cache_hits && !pool->cache_misses)
+			continue;
+		pktbuf_write_DataRow(buf, "ssiiqq",
+				     pool->db->name, pool->user->name,
+				     pool->cache_entries, pool->cache_bytes,
+				     pool->cache_hits, pool->cache_misses);
+	}
+	admin_flush(admin, buf, "SHOW");
+	return true;
+}
 
 /* Command: SHOW LISTS */
 static bool admin_show_lists(PgSocket *admin, const char *arg)
@@ -479,19 +566,39 @@ static bool admin_show_users(PgSocket *admin, const char *arg)
 	return true;
 }
 
+/*
+ * Socket row formats, SKF_STD is prefix of others, as all their
+ * columns are always given to pktbuf_write_*().  Client counters
+ * follow either SKF_STD or buffer state columns.
+ */
 #define SKF_STD "sssssisiTTss"
-#define SKF_DBG "sssssisiTTssiiiiiii"
+#define SKF_CL  SKF_STD "qqqqq"
+#define SKF_DBG SKF_STD "iiiiiii" "qqqqq"
 
-static void socket_header(PktBuf *buf, bool debug)
+static void socket_header(PktBuf *buf, const char *fmt)
 {
-	pktbuf_write_RowDescription(buf, debug ? SKF_DBG : SKF_STD,
+	if (strcmp(fmt, SKF_CL) == 0) {
+		pktbuf_write_RowDescription(buf, fmt,
+					    "type", "user", "database", "state",
+					    "addr", "port", "local_addr", "local_port",
+					    "connect_time", "request_time",
+					    "ptr", "link",
+					    "total_requests", "total_received",
+					    "total_sent", "total_query_time",
+					    "total_wait_time");
+		return;
+	}
+	pktbuf_write_RowDescription(buf, fmt,
 				    "type", "user", "database", "state",
 				    "addr", "port", "local_addr", "local_port",
 				    "connect_time", "request_time",
 				    "ptr", "link",
 				    "recv_pos", "pkt_pos", "pkt_remain",
 				    "send_pos", "send_remain",
-				    "pkt_avail", "send_avail");
+				    "pkt_avail", "send_avail",
+				    "total_requests", "total_received",
+				    "total_sent", "total_query_time",
+				    "total_wait_time");
 }
 
 static void adr2txt(const PgAddr *adr, char *dst, unsigned dstlen)
@@ -504,12 +611,16 @@ static void adr2txt(const PgAddr *adr, char *dst, unsigned dstlen)
 	}
 }
 
-static void socket_row(PktBuf *buf, PgSocket *sk, const char *state, bool debug)
+static void socket_row(PktBuf *buf, PgSocket *sk, const char *state, const char *fmt)
 {
+	usec_t wait_time = sk->stats.wait_time;
 	int pkt_avail = 0, send_avail = 0;
 	char ptrbuf[128], linkbuf[128];
 	char l_addr[32], r_addr[32];
 	IOBuf *io = sk->sbuf.io;
+	const char *type = is_server_socket(sk) ? "S" : "C";
+	const char *user = sk->auth_user ? sk->auth_user->name : "(nouser)";
+	const char *db = sk->pool ? sk->pool->db->name : "(nodb)";
 
 	if (io) {
 		pkt_avail = iobuf_amount_parse(sk->sbuf.io);
@@ -517,7 +628,7 @@ static void socket_row(PktBuf *buf, PgSocket *sk, const char *state, bool debug)
 	}
 
 	adr2txt(&sk->remote_addr, r_addr, sizeof(r_addr));
-	adr2txt(&sk->local_addr, l_addr, sizeof(l_addr));
+	adr2txt(get_local_addr(sk), l_addr, sizeof(l_addr));
 
 	snprintf(ptrbuf, sizeof(ptrbuf), "%p", sk);
 	if (sk->link)
@@ -525,153 +636,428 @@ static void socket_row(PktBuf *buf, PgSocket *sk, const char *state, bool debug)
 	else
 		linkbuf[0] = 0;
 
-	pktbuf_write_DataRow(buf, debug ? SKF_DBG : SKF_STD,
-			     is_server_socket(sk) ? "S" :"C",
-			     sk->auth_user ? sk->auth_user->name : "(nouser)",
-			     sk->pool ? sk->pool->db->name : "(nodb)",
+	/* include wait in progress */
+	if (sk->state == CL_WAITING)
+		wait_time += get_cached_time() - sk->wait_start;
+
+	if (strcmp(fmt, SKF_CL) == 0) {
+		pktbuf_write_DataRow(buf, fmt, type, user, db,
+				     state, r_addr, sk->remote_addr.port,
+				     l_addr, sk->local_addr.port,
+				     sk->connect_time, sk->request_time,
+				     ptrbuf, linkbuf,
+				     sk->stats.request_count,
+				     sk->stats.client_bytes,
+				     sk->stats.server_bytes,
+				     sk->stats.query_time,
+				     wait_time);
+		return;
+	}
+	pktbuf_write_DataRow(buf, fmt, type, user, db,
 			     state, r_addr, sk->remote_addr.port,
 			     l_addr, sk->local_addr.port,
-			     sk->connect_time,
-			     sk->request_time,
+			     sk->connect_time, sk->request_time,
 			     ptrbuf, linkbuf,
 			     io ? io->recv_pos : 0,
 			     io ? io->parse_pos : 0,
 			     sk->sbuf.pkt_remain,
 			     io ? io->done_pos : 0,
 			     0,
-			     pkt_avail, send_avail);
+			     pkt_avail, send_avail,
+			     sk->stats.request_count,
+			     sk->stats.client_bytes,
+			     sk->stats.server_bytes,
+			     sk->stats.query_time,
+			     wait_time);
+}
+
+/*
+ * Socket lists are sent in chunks of STREAM_ROWS rows, next chunk is
+ * formatted only after previous one is sent out, on next event loop
+ * round.  This keeps memory use and loop stalls small even with huge
+ * number of sockets.  The console does not read new queries meanwhile.
+ *
+ * Between chunks the lists may change, the cursor continues after
+ * last shown socket if it is still on same list, otherwise by position.
+ */
+#define STREAM_ROWS 256
+
+struct ShowList {
+	const char *state_name;
+	SocketState state;
+	size_t offset;		/* StatList in PgPool, 0 for login_client_list */
+};
+
+/* optional filters for socket lists: SHOW CLIENTS key=val ... */
+struct ShowFilter {
+	char database[MAX_DBNAME];
+	char user[MAX_USERNAME];
+	char state[16];
+	char addr[32];
+	usec_t min_wait;
+	usec_t min_age;
+	int limit;
+};
+
+struct ShowStream {
+	List head;
+	PgSocket *admin;
+	PktBuf *buf;
+	const struct ShowList *lists;
+	const char *fmt;
+	bool active_only;
+	bool finished;
+	struct ShowFilter filter;
+	int rows;
+
+	/* cursor */
+	PgPool *pool;
+	bool pools_done;
+	int list;
+	PgSocket *last;
+	int pos;
+};
+
+static const struct ShowList client_lists[] = {
+	{"active", CL_ACTIVE, offsetof(PgPool, active_client_list)},
+	{"waiting", CL_WAITING, offsetof(PgPool, waiting_client_list)},
+	{NULL}
+};
+
+static const struct ShowList server_lists[] = {
+	{"active", SV_ACTIVE, offsetof(PgPool, active_server_list)},
+	{"idle", SV_IDLE, offsetof(PgPool, idle_server_list)},
+	{"used", SV_USED, offsetof(PgPool, used_server_list)},
+	{"tested", SV_TESTED, offsetof(PgPool, tested_server_list)},
+	{"new", SV_LOGIN, offsetof(PgPool, new_server_list)},
+	{NULL}
+};
+
+static const struct ShowList socket_lists[] = {
+	{"cl_active", CL_ACTIVE, offsetof(PgPool, active_client_list)},
+	{"cl_waiting", CL_WAITING, offsetof(PgPool, waiting_client_list)},
+	{"sv_active", SV_ACTIVE, offsetof(PgPool, active_server_list)},
+	{"sv_idle", SV_IDLE, offsetof(PgPool, idle_server_list)},
+	{"sv_used", SV_USED, offsetof(PgPool, used_server_list)},
+	{"sv_tested", SV_TESTED, offsetof(PgPool, tested_server_list)},
+	{"sv_login", SV_LOGIN, offsetof(PgPool, new_server_list)},
+	{"cl_login", CL_LOGIN, 0},
+	{NULL}
+};
+
+static LIST(stream_list);
+
+static PgPool *next_pool(PgPool *pool)
+{
+	List *item = pool ? pool->head.next : pool_list.head.next;
+	if (item == &pool_list.head)
+		return NULL;
+	return container_of(item, PgPool, head);
 }
 
-/* Helper for SHOW CLIENTS */
-static void show_socket_list(PktBuf *buf, StatList *list, const char *state, bool debug)
+static bool copy_filter_value(char *dst, const char *val, unsigned dstlen)
 {
-	List *item;
-	PgSocket *sk;
+	if (strlen(val) >= dstlen)
+		return false;
+	safe_strcpy(dst, val, dstlen);
+	return true;
+}
 
-	statlist_for_each(item, list) {
-		sk = container_of(item, PgSocket, head);
-		socket_row(buf, sk, state, debug);
-	}
+static bool parse_filter_time(usec_t *dst, const char *val)
+{
+	char *end;
+	double secs = strtod(val, &end);
+	if (end == val || *end || secs < 0)
+		return false;
+	*dst = (usec_t)(secs * USEC);
+	return true;
 }
 
-/* Command: SHOW CLIENTS */
-static bool admin_show_clients(PgSocket *admin, const char *arg)
+/* parse "key=val key=val ..." */
+static bool parse_filter(struct ShowFilter *f, const char *arg)
 {
-	List *item;
-	PgPool *pool;
-	PktBuf *buf = pktbuf_dynamic(256);
+	char buf[256];
+	char *tok, *val, *pos = NULL;
+	char *end;
+	bool ok;
 
-	if (!buf) {
-		admin_error(admin, "no mem");
+	memset(f, 0, sizeof(*f));
+	if (!arg)
 		return true;
+
+	safe_strcpy(buf, arg, sizeof(buf));
+	for (tok = strtok_r(buf, " \t\n\r", &pos); tok; tok = strtok_r(NULL, " \t\n\r", &pos)) {
+		val = strchr(tok, '=');
+		if (!val || !val[1])
+			return false;
+		*val++ = 0;
+
+		if (strcasecmp(tok, "database") == 0)
+			ok = copy_filter_value(f->database, val, sizeof(f->database));
+		else if (strcasecmp(tok, "user") == 0)
+			ok = copy_filter_value(f->user, val, sizeof(f->user));
+		else if (strcasecmp(tok, "state") == 0)
+			ok = copy_filter_value(f->state, val, sizeof(f->state));
+		else if (strcasecmp(tok, "addr") == 0)
+			ok = copy_filter_value(f->addr, val, sizeof(f->addr));
+		else if (strcasecmp(tok, "wait") == 0)
+			ok = parse_filter_time(&f->min_wait, val);
+		else if (strcasecmp(tok, "age") == 0)
+			ok = parse_filter_time(&f->min_age, val);
+		else if (strcasecmp(tok, "limit") == 0) {
+			f->limit = strtol(val, &end, 10);
+			ok = (*end == 0 && f->limit > 0);
+		} else
+			ok = false;
+		if (!ok)
+			return false;
 	}
+	return true;
+}
 
-	socket_header(buf, false);
-	statlist_for_each(item, &pool_list) {
-		pool = container_of(item, PgPool, head);
+static bool filter_socket(const struct ShowFilter *f, PgSocket *sk)
+{
+	usec_t now = get_cached_time();
+	char addr[32];
 
-		show_socket_list(buf, &pool->active_client_list, "active", false);
-		show_socket_list(buf, &pool->waiting_client_list, "waiting", false);
+	if (f->database[0] && (!sk->pool || strcmp(sk->pool->db->name, f->database) != 0))
+		return false;
+	if (f->user[0] && (!sk->auth_user || strcmp(sk->auth_user->name, f->user) != 0))
+		return false;
+	if (f->addr[0]) {
+		adr2txt(&sk->remote_addr, addr, sizeof(addr));
+		if (strcmp(addr, f->addr) != 0)
+			return false;
 	}
-
-	admin_flush(admin, buf, "SHOW");
+	if (f->min_wait && (sk->state != CL_WAITING || now - sk->wait_start < f->min_wait))
+		return false;
+	if (f->min_age && now - sk->connect_time < f->min_age)
+		return false;
 	return true;
 }
 
-/* Command: SHOW SERVERS */
-static bool admin_show_servers(PgSocket *admin, const char *arg)
+static void stream_next_list(struct ShowStream *st)
+{
+	st->list++;
+	st->last = NULL;
+	st->pos = 0;
+}
+
+/* fetch next socket to show, NULL at the end */
+static PgSocket *stream_next(struct ShowStream *st, const char **state)
 {
+	const struct ShowList *sl;
+	StatList *list;
 	List *item;
-	PgPool *pool;
-	PktBuf *buf;
+	PgSocket *sk;
+	int i;
 
-	buf = pktbuf_dynamic(256);
+	if (st->filter.limit && st->rows >= st->filter.limit)
+		return NULL;
+
+	while (1) {
+		sl = &st->lists[st->list];
+		if (!sl->state_name) {
+			/* pool lists done, global lists after all pools */
+			if (st->pools_done)
+				return NULL;
+			st->pool = next_pool(st->pool);
+			st->pools_done = (st->pool == NULL);
+			st->list = -1;
+			stream_next_list(st);
+			continue;
+		}
+		if ((sl->offset == 0) != st->pools_done) {
+			stream_next_list(st);
+			continue;
+		}
+
+		/* skip whole lists that cannot match */
+		if (st->filter.state[0] && strcmp(sl->state_name, st->filter.state) != 0) {
+			stream_next_list(st);
+			continue;
+		}
+		if (sl->offset && st->filter.database[0]
+		    && strcmp(st->pool->db->name, st->filter.database) != 0) {
+			while (st->lists[st->list].state_name)
+				stream_next_list(st);
+			continue;
+		}
+		if (sl->offset)
+			list = (StatList *)((char *)st->pool + sl->offset);
+		else
+			list = &login_client_list;
+
+		/* freed sockets stay in slab, so ->last can be checked */
+		sk = st->last;
+		if (sk && sk->state == sl->state && (!sl->offset || sk->pool == st->pool)) {
+			item = sk->head.next;
+		} else {
+			item = list->head.next;
+			for (i = 0; i < st->pos && item != &list->head; i++)
+				item = item->next;
+		}
+		if (item == &list->head) {
+			stream_next_list(st);
+			continue;
+		}
+
+		sk = container_of(item, PgSocket, head);
+		st->last = sk;
+		st->pos++;
+		if (st->active_only && sbuf_is_empty(&sk->sbuf))
+			continue;
+		if (!filter_socket(&st->filter, sk))
+			continue;
+		st->rows++;
+		*state = sl->state_name;
+		return sk;
+	}
+}
+
+static void stream_free(struct ShowStream *st)
+{
+	list_del(&st->head);
+	free(st);
+}
+
+static bool stream_fill(PktBuf *buf, void *arg)
+{
+	struct ShowStream *st = arg;
+	PgSocket *admin = st->admin;
+	const char *state;
+	PgSocket *sk;
+	int rows;
+
+	/* sending failed */
 	if (!buf) {
-		admin_error(admin, "no mem");
-		return true;
+		stream_free(st);
+		disconnect_client(admin, false, "failed to send SHOW result");
+		return false;
 	}
 
-	socket_header(buf, false);
-	statlist_for_each(item, &pool_list) {
-		pool = container_of(item, PgPool, head);
-		show_socket_list(buf, &pool->active_server_list, "active", false);
-		show_socket_list(buf, &pool->idle_server_list, "idle", false);
-		show_socket_list(buf, &pool->used_server_list, "used", false);
-		show_socket_list(buf, &pool->tested_server_list, "tested", false);
-		show_socket_list(buf, &pool->new_server_list, "new", false);
+	/* all sent, continue reading queries */
+	if (st->finished) {
+		stream_free(st);
+		sbuf_continue(&admin->sbuf);
+		return false;
+	}
+
+	for (rows = 0; rows < STREAM_ROWS; rows++) {
+		sk = stream_next(st, &state);
+		if (!sk) {
+			pktbuf_write_CommandComplete(buf, "SHOW");
+			pktbuf_write_ReadyForQuery(buf);
+			st->finished = true;
+			break;
+		}
+		socket_row(buf, sk, state, st->fmt);
 	}
-	admin_flush(admin, buf, "SHOW");
 	return true;
 }
 
-/* Command: SHOW SOCKETS */
-static bool admin_show_sockets(PgSocket *admin, const char *arg)
+static bool show_socket_stream(PgSocket *admin, const char *arg, const struct ShowList *lists,
+			       const char *fmt, bool active_only)
 {
-	List *item;
-	PgPool *pool;
+	struct ShowStream *st;
+	struct ShowFilter filter;
 	PktBuf *buf;
 
+	if (!parse_filter(&filter, arg))
+		return admin_error(admin, "bad filter, expected key=value with keys: "
+				   "database, user, state, addr, wait, age, limit");
+
+	st = zmalloc(sizeof(*st));
 	buf = pktbuf_dynamic(256);
-	if (!buf) {
+	if (!st || !buf) {
+		free(st);
+		if (buf)
+			pktbuf_free(buf);
 		admin_error(admin, "no mem");
 		return true;
 	}
-
-	socket_header(buf, true);
-	statlist_for_each(item, &pool_list) {
-		pool = container_of(item, PgPool, head);
-		show_socket_list(buf, &pool->active_client_list, "cl_active", true);
-		show_socket_list(buf, &pool->waiting_client_list, "cl_waiting", true);
-
-		show_socket_list(buf, &pool->active_server_list, "sv_active", true);
-		show_socket_list(buf, &pool->idle_server_list, "sv_idle", true);
-		show_socket_list(buf, &pool->used_server_list, "sv_used", true);
-		show_socket_list(buf, &pool->tested_server_list, "sv_tested", true);
-		show_socket_list(buf, &pool->new_server_list, "sv_login", true);
+	list_init(&st->head);
+	st->admin = admin;
+	st->buf = buf;
+	st->lists = lists;
+	st->fmt = fmt;
+	st->active_only = active_only;
+	st->filter = filter;
+	st->pool = next_pool(NULL);
+	st->pools_done = (st->pool == NULL);
+
+	socket_header(buf, fmt);
+	stream_fill(buf, st);
+
+	if (!sbuf_pause(&admin->sbuf)) {
+		pktbuf_free(buf);
+		free(st);
+		admin_error(admin, "cannot pause console");
+		return true;
+	}
+	list_append(&st->head, &stream_list);
+	if (!pktbuf_send_stream(buf, admin, stream_fill, st)) {
+		stream_free(st);
+		sbuf_continue(&admin->sbuf);
+		return admin_error(admin, "failed to send result");
 	}
-	show_socket_list(buf, &login_client_list, "cl_login", true);
-	admin_flush(admin, buf, "SHOW");
 	return true;
 }
 
-static void show_active_socket_list(PktBuf *buf, StatList *list, const char *state)
+/* stop SHOW output, console is closing */
+void admin_stream_abort(PgSocket *admin)
 {
-	List *item;
-	statlist_for_each(item, list) {
-		PgSocket *sk = container_of(item, PgSocket, head);
-		if (!sbuf_is_empty(&sk->sbuf))
-			socket_row(buf, sk, state, true);
+	List *item, *tmp;
+	struct ShowStream *st;
+
+	list_for_each_safe(item, &stream_list, tmp) {
+		st = container_of(item, struct ShowStream, head);
+		if (st->admin != admin)
+			continue;
+		pktbuf_cancel(st->buf);
+		stream_free(st);
 	}
 }
 
-/* Command: SHOW ACTIVE_SOCKETS */
-static bool admin_show_active_sockets(PgSocket *admin, const char *arg)
+/* pool is going away, move cursors off it */
+void admin_stream_forget_pool(PgPool *pool)
 {
 	List *item;
-	PgPool *pool;
-	PktBuf *buf;
+	struct ShowStream *st;
 
-	buf = pktbuf_dynamic(256);
-	if (!buf) {
-		admin_error(admin, "no mem");
-		return true;
+	list_for_each(item, &stream_list) {
+		st = container_of(item, struct ShowStream, head);
+		if (st->pool != pool)
+			continue;
+		st->pool = next_pool(pool);
+		st->pools_done = (st->pool == NULL);
+		st->list = -1;
+		stream_next_list(st);
 	}
+}
 
-	socket_header(buf, true);
-	statlist_for_each(item, &pool_list) {
-		pool = container_of(item, PgPool, head);
-		show_active_socket_list(buf, &pool->active_client_list, "cl_active");
-		show_active_socket_list(buf, &pool->waiting_client_list, "cl_waiting");
-
-		show_active_socket_list(buf, &pool->active_server_list, "sv_active");
-		show_active_socket_list(buf, &pool->idle_server_list, "sv_idle");
-		show_active_socket_list(buf, &pool->used_server_list, "sv_used");
-		show_active_socket_list(buf, &pool->tested_server_list, "sv_tested");
-		show_active_socket_list(buf, &pool->new_server_list, "sv_login");
-	}
-	show_active_socket_list(buf, &login_client_list, "cl_login");
-	admin_flush(admin, buf, "SHOW");
-	return true;
+/* Command: SHOW CLIENTS */
+static bool admin_show_clients(PgSocket *admin, const char *arg)
+{
+	return show_socket_stream(admin, arg, client_lists, SKF_CL, false);
+}
+
+/* Command: SHOW SERVERS */
+static bool admin_show_servers(PgSocket *admin, const char *arg)
+{
+	return show_socket_stream(admin, arg, server_lists, SKF_STD, false);
+}
+
+/* Command: SHOW SOCKETS */
+static bool admin_show_sockets(PgSocket *admin, const char *arg)
+{
+	return show_socket_stream(admin, arg, socket_lists, SKF_DBG, false);
+}
+
+/* Command: SHOW ACTIVE_SOCKETS */
+static bool admin_show_active_sockets(PgSocket *admin, const char *arg)
+{
+	return show_socket_stream(admin, arg, socket_lists, SKF_DBG, true);
 }
 
 /* Command: SHOW POOLS */
@@ -688,19 +1074,24 @@ static bool admin_show_pools(PgSocket *admin, const char *arg)
 		admin_error(admin, "no mem");
 		return true;
 	}
-	pktbuf_write_RowDescription(buf, "ssiiiiiiii",
+	pktbuf_write_RowDescription(buf, "ssiiiiiiiiiii",
 				    "database", "user",
 				    "cl_active", "cl_waiting",
+				    "cl_waiting_priority", "cl_waiting_normal",
+				    "cl_waiting_batch",
 				    "sv_active", "sv_idle",
 				    "sv_used", "sv_tested",
 				    "sv_login", "maxwait");
 	statlist_for_each(item, &pool_list) {
 		pool = container_of(item, PgPool, head);
-		waiter = first_socket(&pool->waiting_client_list);
-		pktbuf_write_DataRow(buf, "ssiiiiiiii",
+		waiter = oldest_waiting_client(pool);
+		pktbuf_write_DataRow(buf, "ssiiiiiiiiiii",
 				     pool->db->name, pool->user->name,
 				     statlist_count(&pool->active_client_list),
 				     statlist_count(&pool->waiting_client_list),
+				     pool->wait_count[WAIT_PRIORITY],
+				     pool->wait_count[WAIT_NORMAL],
+				     pool->wait_count[WAIT_BATCH],
 				     statlist_count(&pool->active_server_list),
 				     statlist_count(&pool->idle_server_list),
 				     statlist_count(&pool->used_server_list),
@@ -747,6 +1138,7 @@ static bool admin_show_config(PgSocket *admin, const char *arg)
 	ConfElem *cf;
 	int i = 0;
 	PktBuf *buf;
+	char tmp[32];
 
 	buf = pktbuf_dynamic(256);
 	if (!buf) {
@@ -764,6 +1156,16 @@ static bool admin_show_config(PgSocket *admin, const char *arg)
 				     cf->name, conf_to_text(cf),
 				     cf->reloadable ? "yes" : "no");
 	}
+
+	/* result of last config load */
+	pktbuf_write_DataRow(buf, "sss", "last_reload",
+			     format_date(g_reload_time), "no");
+	snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)g_reload_duration);
+	pktbuf_write_DataRow(buf, "sss", "last_reload_usec", tmp, "no");
+	snprintf(tmp, sizeof(tmp), "%d", g_reload_changed);
+	pktbuf_write_DataRow(buf, "sss", "last_reload_changed", tmp, "no");
+	snprintf(tmp, sizeof(tmp), "%d", g_reload_removed);
+	pktbuf_write_DataRow(buf, "sss", "last_reload_removed", tmp, "no");
 	admin_flush(admin, buf, "SHOW");
 	return true;
 }
@@ -939,15 +1341,20 @@ static bool admin_show_help(PgSocket *admin, const char *arg)
 	SEND_generic(res, admin, 'N',
 		"sssss",
 		"SNOTICE", "C00000", "MConsole usage",
-		"D\n\tSHOW HELP|CONFIG|DATABASES"
+		"D\n\tSHOW HELP|CONFIG|DATABASES|HOSTS"
 		"|POOLS|CLIENTS|SERVERS|VERSION\n"
-		"\tSHOW STATS|FDS|SOCKETS|ACTIVE_SOCKETS|LISTS|MEM\n"
+		"\tSHOW CACHE\n"
+		"\tSHOW STATS|STATS_USERS|FDS|SOCKETS|ACTIVE_SOCKETS|LISTS|MEM\n"
+		"\tSHOW STATS|STATS_USERS|TOTALS <seconds>\n"
+		"\tSHOW CLIENTS|SERVERS|SOCKETS|ACTIVE_SOCKETS [key=value ...]\n"
+		"\tSHOW TRACE [<n>]\n"
 		"\tSET key = arg\n"
 		"\tRELOAD\n"
 		"\tPAUSE [<db>]\n"
 		"\tSUSPEND\n"
 		"\tRESUME [<db>]\n"
-		"\tSHUTDOWN", "");
+		"\tSHUTDOWN\n"
+		"\tTRACE DUMP|CLEAR", "");
 	if (res)
 		res = admin_ready(admin, "SHOW");
 	return res;
@@ -964,32 +1371,68 @@ static bool admin_show_version(PgSocket *admin, const char *arg)
 	return res;
 }
 
+/* optional averaging window in seconds, 0 means stats_period */
+static bool get_window(const char *arg, int *window)
+{
+	char *end;
+	long val;
+
+	*window = 0;
+	if (!arg)
+		return true;
+	val = strtol(arg, &end, 10);
+	if (*end || val < 1 || val > STATS_MAX_WINDOW)
+		return false;
+	*window = val;
+	return true;
+}
+
+#define BAD_WINDOW "window must be 1..%d seconds"
+
 static bool admin_show_stats(PgSocket *admin, const char *arg)
 {
-	return admin_database_stats(admin, &pool_list);
+	int window;
+	if (!get_window(arg, &window))
+		return admin_error(admin, BAD_WINDOW, STATS_MAX_WINDOW);
+	return admin_database_stats(admin, &pool_list, window);
+}
+
+static bool admin_show_stats_users(PgSocket *admin, const char *arg)
+{
+	int window;
+	if (!get_window(arg, &window))
+		return admin_error(admin, BAD_WINDOW, STATS_MAX_WINDOW);
+	return admin_user_stats(admin, &user_list, window);
 }
 
 static bool admin_show_totals(PgSocket *admin, const char *arg)
 {
-	return show_stat_totals(admin, &pool_list);
+	int window;
+	if (!get_window(arg, &window))
+		return admin_error(admin, BAD_WINDOW, STATS_MAX_WINDOW);
+	return show_stat_totals(admin, &pool_list, window);
 }
 
 
 static struct cmd_lookup show_map [] = {
+	{"cache", admin_show_cache},
 	{"clients", admin_show_clients},
 	{"config", admin_show_config},
 	{"databases", admin_show_databases},
 	{"fds", admin_show_fds},
 	{"help", admin_show_help},
+	{"hosts", admin_show_hosts},
 	{"lists", admin_show_lists},
 	{"pools", admin_show_pools},
 	{"servers", admin_show_servers},
 	{"sockets", admin_show_sockets},
 	{"active_sockets", admin_show_active_sockets},
 	{"stats", admin_show_stats},
+	{"stats_users", admin_show_stats_users},
 	{"users", admin_show_users},
 	{"version", admin_show_version},
 	{"totals", admin_show_totals},
+	{"trace", admin_show_trace},
 	{"mem", admin_show_mem},
 	{NULL, NULL}
 };
@@ -1009,6 +1452,7 @@ static struct cmd_lookup cmd_list [] = {
 	{"show", admin_cmd_show},
 	{"shutdown", admin_cmd_shutdown},
 	{"suspend", admin_cmd_suspend},
+	{"trace", admin_cmd_trace},
 	{NULL, NULL}
 };
 
@@ -1025,6 +1469,13 @@ static bool admin_parse_query(PgSocket *admin, const char *q)
 		copy_arg(q, grp, CMD_NAME, cmd, sizeof(cmd));
 		copy_arg(q, grp, CMD_ARG, arg, sizeof(arg));
 		res = exec_cmd(cmd_list, admin, cmd, arg);
+	} else if (regexec(&rc_show_args, q, MAX_GROUPS, grp, 0) == 0) {
+		copy_arg(q, grp, SHOW_NAME, arg, sizeof(arg));
+		copy_arg(q, grp, SHOW_ARGS, val, sizeof(val));
+		if (!arg[0] || !val[0])
+			res = admin_error(admin, "bad arguments");
+		else
+			res = exec_cmd(show_map, admin, arg, val);
 	} else if (regexec(&rc_set_str, q, MAX_GROUPS, grp, 0) == 0) {
 		copy_arg(q, grp, SET_KEY, arg, sizeof(arg));
 		copy_arg_unquote(q, grp, SET_VAL, val, sizeof(val));
@@ -1052,6 +1503,13 @@ bool admin_handle_client(PgSocket *admin, PktHdr *pkt)
 {
 	const char *q;
 	bool res;
+	List *item;
+
+	/* previous SHOW is still being sent, leave pkt in buffer */
+	list_for_each(item, &stream_list) {
+		if (container_of(item, struct ShowStream, head)->admin == admin)
+			return false;
+	}
 
 	/* dont tolerate partial packets */
 	if (incomplete_pkt(pkt)) {
@@ -1189,6 +1647,9 @@ void admin_setup(void)
 	res = regcomp(&rc_set_str, cmd_set_str_rx, REG_EXTENDED | REG_ICASE);
 	if (res != 0)
 		fatal("set/str regex compilation error");
+	res = regcomp(&rc_show_args, cmd_show_args_rx, REG_EXTENDED | REG_ICASE);
+	if (res != 0)
+		fatal("show/args regex compilation error");
 }
 
 void admin_pause_done(void)
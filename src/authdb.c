@@ -0,0 +1,278 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Compiled auth file.
+ *
+ * "pgbouncer --compile-auth" turns text auth file into sorted array
+ * of fixed-size records.  Such file is mmap()-ed and searched with
+ * binary search, PgUser objects are created only for users that
+ * actually log in.  Loading only validates the records, which is
+ * much cheaper than parsing text file into user objects.
+ *
+ * The file must be replaced with rename(), as mapped file
+ * cannot change under running process.
+ */
+
+#include "bouncer.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define AUTHDB_HDR_LEN	16
+
+/*
+ * File layout: magic[8], rec_size and count as 32-bit
+ * network order ints, then records sorted by name.
+ */
+struct AuthDbRecord {
+	char name[MAX_USERNAME];
+	char passwd[MAX_PASSWORD];
+};
+
+static void *map_base;
+static size_t map_len;
+static const struct AuthDbRecord *rec_list;
+static unsigned rec_count;
+
+bool authdb_active(void)
+{
+	return rec_list != NULL;
+}
+
+bool authdb_is_compiled(const char *fn)
+{
+	char buf[AUTHDB_HDR_LEN];
+	int fd, res;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0)
+		return false;
+	res = safe_read(fd, buf, sizeof(buf));
+	close(fd);
+	return res == sizeof(buf) && memcmp(buf, AUTHDB_MAGIC, 8) == 0;
+}
+
+static const char *lookup_passwd(const char *name)
+{
+	const struct AuthDbRecord *rec;
+	unsigned lo = 0, hi = rec_count, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		rec = &rec_list[mid];
+		cmp = strncmp(name, rec->name, MAX_USERNAME);
+		if (cmp == 0)
+			return rec->passwd;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+/* create PgUser for user in compiled file */
+PgUser *authdb_get_user(const char *name)
+{
+	const char *passwd = lookup_passwd(name);
+	PgUser *user;
+
+	if (!passwd)
+		return NULL;
+	user = add_user(name, passwd);
+	if (!user)
+		log_warning("cannot create user, no memory");
+	return user;
+}
+
+/* users in memory take passwords from new file */
+static void refresh_users(void)
+{
+	const char *passwd;
+	PgUser *user;
+	List *item;
+
+	statlist_for_each(item, &user_list) {
+		user = container_of(item, PgUser, head);
+		if (user->from_query)
+			continue;
+		passwd = lookup_passwd(user->name);
+		safe_strcpy(user->passwd, passwd ? passwd : "", sizeof(user->passwd));
+	}
+}
+
+void authdb_close(void)
+{
+	if (!map_base)
+		return;
+	munmap(map_base, map_len);
+	map_base = NULL;
+	map_len = 0;
+	rec_list = NULL;
+	rec_count = 0;
+}
+
+/*
+ * Records are used directly from mapped file, so check that fields
+ * are terminated and names ascending, as binary search needs.
+ */
+static bool check_records(const char *fn, const struct AuthDbRecord *list, unsigned count)
+{
+	const struct AuthDbRecord *rec;
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		rec = &list[i];
+		if (!memchr(rec->name, 0, sizeof(rec->name))
+		    || !memchr(rec->passwd, 0, sizeof(rec->passwd))) {
+			log_error("%s: record %u is not terminated", fn, i);
+			return false;
+		}
+		if (i > 0 && strcmp(list[i - 1].name, rec->name) >= 0) {
+			log_error("%s: record %u is not in sorted order", fn, i);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool authdb_load(const char *fn)
+{
+	struct stat st;
+	uint8_t *p;
+	void *base;
+	unsigned count, rec_size;
+	int fd;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		log_error("%s: %s", fn, strerror(errno));
+		return false;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < AUTHDB_HDR_LEN) {
+		log_error("%s: bad compiled auth file", fn);
+		close(fd);
+		return false;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		log_error("%s: mmap: %s", fn, strerror(errno));
+		return false;
+	}
+
+	p = base;
+	memcpy(&rec_size, p + 8, 4);
+	memcpy(&count, p + 12, 4);
+	rec_size = ntohl(rec_size);
+	count = ntohl(count);
+	if (memcmp(p, AUTHDB_MAGIC, 8) != 0
+	    || rec_size != sizeof(struct AuthDbRecord)
+	    || (uint64_t)st.st_size != AUTHDB_HDR_LEN + (uint64_t)count * rec_size) {
+		log_error("%s: bad compiled auth file", fn);
+		munmap(base, st.st_size);
+		return false;
+	}
+	if (!check_records(fn, (const struct AuthDbRecord *)(p + AUTHDB_HDR_LEN), count)) {
+		munmap(base, st.st_size);
+		return false;
+	}
+
+	authdb_close();
+	map_base = base;
+	map_len = st.st_size;
+	rec_list = (const struct AuthDbRecord *)(p + AUTHDB_HDR_LEN);
+	rec_count = count;
+
+	refresh_users();
+	log_info("%s: compiled auth file with %u users", fn, count);
+	return true;
+}
+
+/*
+ * Offline tool, runs before anything is initialized,
+ * so errors go directly to stderr.
+ */
+bool authdb_compile(const char *src, const char *dst)
+{
+	struct AuthDbRecord rec;
+	char tmp_fn[PATH_MAX];
+	uint32_t hdr[2];
+	AuthList *lst;
+	AuthEntry *e, *end;
+	unsigned count = 0;
+	FILE *f;
+
+	lst = parse_auth_file(src);
+	if (!lst || !lst->buf || lst->error) {
+		fprintf(stderr, "%s: %s\n", src, lst ? lst->error : "no mem");
+		free_auth_list(lst);
+		return false;
+	}
+
+	snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", dst);
+	f = fopen(tmp_fn, "wb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", tmp_fn, strerror(errno));
+		free_auth_list(lst);
+		return false;
+	}
+
+	/* count is filled after duplicates are skipped */
+	memset(hdr, 0, sizeof(hdr));
+	fwrite(AUTHDB_MAGIC, 8, 1, f);
+	fwrite(hdr, sizeof(hdr), 1, f);
+
+	end = lst->list + lst->count;
+	for (e = lst->list; e < end; e++) {
+		/* same user repeated, last one wins */
+		if (e + 1 < end && strcmp(e->name, e[1].name) == 0)
+			continue;
+		memset(&rec, 0, sizeof(rec));
+		safe_strcpy(rec.name, e->name, sizeof(rec.name));
+		safe_strcpy(rec.passwd, e->passwd, sizeof(rec.passwd));
+		fwrite(&rec, sizeof(rec), 1, f);
+		count++;
+	}
+	free_auth_list(lst);
+
+	hdr[0] = htonl(sizeof(rec));
+	hdr[1] = htonl(count);
+	fseek(f, 8, SEEK_SET);
+	fwrite(hdr, sizeof(hdr), 1, f);
+
+	if (ferror(f) || fflush(f) != 0 || fsync(fileno(f)) < 0) {
+		fprintf(stderr, "%s: %s\n", tmp_fn, strerror(errno));
+		fclose(f);
+		unlink(tmp_fn);
+		return false;
+	}
+	fclose(f);
+
+	if (rename(tmp_fn, dst) < 0) {
+		fprintf(stderr, "%s: %s\n", dst, strerror(errno));
+		unlink(tmp_fn);
+		return false;
+	}
+	printf("%s: %u users\n", dst, count);
+	return true;
+}
+
@@ -0,0 +1,393 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Credential lookup with auth_query.
+ *
+ * Users missing from auth_file are looked up by running auth_query as
+ * auth_user on the database the client wants.  Meanwhile the client sits
+ * on that auth pool like any client waiting for server, and when the
+ * answer arrives its startup packet is parsed again.  Answers, also
+ * "no such user", are kept in LRU cache for a while so that repeated
+ * logins do not hit the server.
+ */
+
+#include "bouncer.h"
+
+#define AUTH_BUCKETS	256
+
+/* larger DataRow cannot be name and password */
+#define MAX_AUTH_ROW	(MAX_USERNAME + MAX_PASSWORD + 16)
+
+struct AuthCacheEntry {
+	List head;		/* entry in hash bucket */
+	List lru;		/* entry in auth_lru, most recently used first */
+	PgDatabase *db;
+	usec_t expire;
+	uint32_t hash;
+	bool found;		/* false means cached "no such user" */
+	bool sent;		/* lookup: auth_query sent to server */
+	bool failed;		/* lookup: error, do not cache */
+	char name[MAX_USERNAME];
+	char passwd[MAX_PASSWORD];
+};
+
+static List auth_buckets[AUTH_BUCKETS];
+static LIST(auth_lru);
+static int auth_entries;
+
+void auth_query_setup(void)
+{
+	int i;
+	for (i = 0; i < AUTH_BUCKETS; i++)
+		list_init(&auth_buckets[i]);
+}
+
+static uint32_t auth_hash(PgDatabase *db, const char *name)
+{
+	return lookup3_hash(name, strlen(name)) ^ ptr_hash32(db);
+}
+
+static void drop_entry(AuthCacheEntry *e)
+{
+	list_del(&e->head);
+	list_del(&e->lru);
+	auth_entries--;
+	free(e);
+}
+
+/* drop least recently used entries until count is below max */
+static void trim_cache(int max)
+{
+	AuthCacheEntry *e;
+
+	while (auth_entries > max && !list_empty(&auth_lru)) {
+		e = container_of(auth_lru.prev, AuthCacheEntry, lru);
+		drop_entry(e);
+	}
+}
+
+static AuthCacheEntry *find_entry(PgDatabase *db, const char *name)
+{
+	uint32_t hash = auth_hash(db, name);
+	AuthCacheEntry *e;
+	List *item;
+
+	list_for_each(item, &auth_buckets[hash % AUTH_BUCKETS]) {
+		e = container_of(item, AuthCacheEntry, head);
+		if (e->hash == hash && e->db == db && strcmp(e->name, name) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/* remember finished lookup, replacing older answer */
+static void store_entry(AuthCacheEntry *e)
+{
+	AuthCacheEntry *old;
+
+	if (e->failed || cf_auth_cache_size <= 0) {
+		free(e);
+		return;
+	}
+	old = find_entry(e->db, e->name);
+	if (old)
+		drop_entry(old);
+	trim_cache(cf_auth_cache_size - 1);
+
+	e->expire = get_cached_time();
+	e->expire += e->found ? cf_auth_cache_ttl : cf_auth_cache_negative_ttl;
+	list_append(&e->head, &auth_buckets[e->hash % AUTH_BUCKETS]);
+	list_prepend(&e->lru, &auth_lru);
+	auth_entries++;
+}
+
+/* turn answer into user object */
+static PgUser *use_entry(AuthCacheEntry *e)
+{
+	PgUser *user = find_user(e->name);
+
+	/* auth_file may have got the user meanwhile */
+	if (user && !user->from_query)
+		return user;
+
+	if (!e->found) {
+		if (user)
+			user->passwd[0] = 0;
+		return NULL;
+	}
+
+	user = add_user(e->name, e->passwd);
+	if (!user) {
+		log_warning("cannot create user, no memory");
+		return NULL;
+	}
+	user->from_query = 1;
+	return user;
+}
+
+/*
+ * User of taken over connection, its session is already authenticated
+ * so no lookup is needed.  New logins still run auth_query as the
+ * placeholder has no password.
+ */
+PgUser *auth_query_user(const char *name)
+{
+	PgUser *user = find_user(name);
+
+	if (user)
+		return user;
+	user = add_user(name, "");
+	if (!user)
+		return NULL;
+	user->from_query = 1;
+	return user;
+}
+
+/*
+ * Called for user not in auth_file or got from earlier lookup.
+ *
+ * Returns true if *user_p is the answer, NULL meaning no such user.
+ * Returns false if client was parked on auth pool or dropped.
+ */
+bool auth_query_lookup(PgSocket *client, PgDatabase *db, const char *name, PgUser **user_p)
+{
+	AuthCacheEntry *e = client->auth_lookup;
+	PgUser *auth_user;
+	PgPool *pool;
+
+	/* this client's own lookup has finished */
+	if (e) {
+		client->auth_lookup = NULL;
+		if (e->db == db && strcmp(e->name, name) == 0) {
+			*user_p = use_entry(e);
+			store_entry(e);
+			return true;
+		}
+		free(e);
+	}
+
+	if (!*cf_auth_user) {
+		/* auth_query was turned off */
+		if (*user_p && (*user_p)->from_query)
+			*user_p = NULL;
+		return true;
+	}
+	if (db->admin)
+		return true;
+
+	e = find_entry(db, name);
+	if (e && e->expire > get_cached_time()) {
+		list_del(&e->lru);
+		list_prepend(&e->lru, &auth_lru);
+		*user_p = use_entry(e);
+		return true;
+	}
+
+	auth_user = find_user(cf_auth_user);
+	if (!auth_user || auth_user->from_query) {
+		slog_error(client, "auth_user %s not in auth_file", cf_auth_user);
+		disconnect_client(client, true, "bouncer config error");
+		return false;
+	}
+	pool = get_pool(db, auth_user);
+	if (!pool) {
+		disconnect_client(client, true, "no memory for pool");
+		return false;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e) {
+		disconnect_client(client, true, "no memory for auth_query");
+		return false;
+	}
+	list_init(&e->head);
+	list_init(&e->lru);
+	e->db = db;
+	e->hash = auth_hash(db, name);
+	safe_strcpy(e->name, name, sizeof(e->name));
+
+	slog_debug(client, "auth_query lookup for %s", name);
+	client->auth_lookup = e;
+	client->wait_for_user = 1;
+	client->auth_user = auth_user;
+	client->pool = pool;
+	change_client_state(client, CL_ACTIVE);
+
+	auth_query_continue(client);
+	return false;
+}
+
+/* get server from auth pool and send query, client stays paused */
+void auth_query_continue(PgSocket *client)
+{
+	AuthCacheEntry *e = client->auth_lookup;
+	PgSocket *server;
+	uint8_t data[1024];
+	PktBuf buf;
+	int len = strlen(e->name);
+
+	if (e->sent || !find_server(client))
+		return;
+	server = client->link;
+
+	pktbuf_static(&buf, data, sizeof(data));
+	pktbuf_write_generic(&buf, 'P', "ssh", "", cf_auth_query, 0);
+	pktbuf_write_generic(&buf, 'B', "sshhibh", "", "", 0, 1, len, e->name, len, 0);
+	pktbuf_write_generic(&buf, 'E', "si", "", 0);
+	pktbuf_write_generic(&buf, 'S', "");
+	if (buf.failed) {
+		slog_error(client, "auth_query too long");
+		disconnect_client(client, true, "bouncer config error");
+		return;
+	}
+
+	slog_debug(server, "sending auth_query for %s", e->name);
+	if (!pktbuf_send_immidiate(&buf, server)) {
+		disconnect_server(server, true, "failed to send auth_query");
+		return;
+	}
+	e->sent = 1;
+	server->ready = 0;
+	if (!sbuf_pause(&client->sbuf))
+		disconnect_client(client, true, "pause failed");
+}
+
+/* DataRow must be (name, password), NULL password means no password */
+static void parse_row(PgSocket *server, AuthCacheEntry *e, PktHdr *pkt)
+{
+	const uint8_t *val;
+	uint32_t len;
+
+	if (pkt->len > MAX_AUTH_ROW)
+		goto bad;
+	if (mbuf_avail(&pkt->data) < 6 || mbuf_get_uint16(&pkt->data) != 2)
+		goto bad;
+	len = mbuf_get_uint32(&pkt->data);
+	if (len > mbuf_avail(&pkt->data) || mbuf_avail(&pkt->data) - len < 4)
+		goto bad;
+	mbuf_get_bytes(&pkt->data, len);
+	len = mbuf_get_uint32(&pkt->data);
+	if (len == (uint32_t)-1) {
+		e->passwd[0] = 0;
+	} else {
+		if (len >= MAX_PASSWORD || mbuf_avail(&pkt->data) < len)
+			goto bad;
+		val = mbuf_get_bytes(&pkt->data, len);
+		memcpy(e->passwd, val, len);
+		e->passwd[len] = 0;
+	}
+	e->found = 1;
+	return;
+bad:
+	slog_error(server, "auth_query must return user name and password");
+	e->failed = 1;
+}
+
+static void finish_lookup(PgSocket *server, PgSocket *client)
+{
+	client->wait_for_user = 0;
+
+	if (server->tx_state == 'I') {
+		server->ready = 1;
+		release_server(server);
+	} else {
+		server->link = NULL;
+		client->link = NULL;
+		disconnect_server(server, true, "auth_query left open transaction");
+	}
+
+	if (client->auth_lookup->failed) {
+		disconnect_client(client, true, "auth_query failed");
+		return;
+	}
+
+	/* back to login state, startup packet is parsed again */
+	change_client_state(client, CL_LOGIN);
+	client->pool = NULL;
+	client->auth_user = NULL;
+	sbuf_continue(&client->sbuf);
+}
+
+/* server packet for client waiting on lookup */
+bool auth_query_packet(PgSocket *server, PktHdr *pkt)
+{
+	PgSocket *client = server->link;
+	AuthCacheEntry *e = client->auth_lookup;
+
+	switch (pkt->type) {
+	case 'D':		/* DataRow */
+		if (incomplete_pkt(pkt) && pkt->len <= MAX_AUTH_ROW)
+			return false;
+		if (e->found)
+			e->failed = 1;
+		else
+			parse_row(server, e, pkt);
+		break;
+	case 'E':		/* ErrorResponse */
+		log_server_error("auth_query failed", pkt);
+		e->failed = 1;
+		break;
+	case 'Z':		/* ReadyForQuery */
+		if (mbuf_avail(&pkt->data) == 0)
+			return false;
+		server->tx_state = mbuf_get_char(&pkt->data);
+		sbuf_prepare_skip(&server->sbuf, pkt->len);
+		finish_lookup(server, client);
+		return true;
+	}
+	sbuf_prepare_skip(&server->sbuf, pkt->len);
+	return true;
+}
+
+/* client went away during lookup */
+void auth_query_abort(PgSocket *client)
+{
+	if (client->auth_lookup) {
+		free(client->auth_lookup);
+		client->auth_lookup = NULL;
+	}
+	client->wait_for_user = 0;
+}
+
+void auth_query_purge_db(PgDatabase *db)
+{
+	List *item, *tmp;
+	AuthCacheEntry *e;
+
+	list_for_each_safe(item, &auth_lru, tmp) {
+		e = container_of(item, AuthCacheEntry, lru);
+		if (e->db == db)
+			drop_entry(e);
+	}
+}
+
+/* drop expired entries, also apply lowered auth_cache_size */
+void auth_query_maint(void)
+{
+	usec_t now = get_cached_time();
+	List *item, *tmp;
+	AuthCacheEntry *e;
+
+	list_for_each_safe(item, &auth_lru, tmp) {
+		e = container_of(item, AuthCacheEntry, lru);
+		if (e->expire <= now)
+			drop_entry(e);
+	}
+	trim_cache(cf_auth_cache_size);
+}
@@ -0,0 +1,260 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Watching and reloading auth_file.
+ *
+ * Changes are noticed with inotify, without it janitor polls stat().
+ * The file is parsed in separate thread, result is passed back via
+ * pipe and merged into user list in main thread.  Without threads
+ * everything happens in main thread.
+ */
+
+#include "bouncer.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+#define USE_AUTH_THREAD
+#endif
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_INOTIFY_INIT)
+#define USE_INOTIFY
+#endif
+
+#ifdef USE_AUTH_THREAD
+
+struct AuthRequest {
+	char *fn;
+	AuthList *result;
+};
+
+static int result_pipe[2] = { -1, -1 };
+static struct event ev_result;
+
+/* reload in progress, and whether file changed meanwhile */
+static bool reload_running;
+static bool reload_again;
+
+/* runs in parser thread */
+static void *auth_parse_thread(void *arg)
+{
+	struct AuthRequest *req = arg;
+	int res;
+
+	req->result = parse_auth_file(req->fn);
+	do {
+		res = write(result_pipe[1], &req, sizeof(req));
+	} while (res < 0 && errno == EINTR);
+	return NULL;
+}
+
+static void auth_result_cb(int fd, short flags, void *arg)
+{
+	struct AuthRequest *req;
+
+	while (read(fd, &req, sizeof(req)) == sizeof(req)) {
+		apply_auth_list(req->fn, req->result);
+		free(req->fn);
+		free(req);
+		reload_running = false;
+	}
+
+	if (reload_again && !reload_running) {
+		reload_again = false;
+		auth_reload_async();
+	}
+}
+
+void auth_reload_async(void)
+{
+	struct AuthRequest *req;
+	pthread_t thread;
+	int err;
+
+	if (reload_running) {
+		reload_again = true;
+		return;
+	}
+
+	/* compiled file is only mapped, that is fast */
+	if (authdb_is_compiled(cf_auth_file)) {
+		load_auth_file(cf_auth_file);
+		return;
+	}
+
+	req = calloc(1, sizeof(*req));
+	if (req)
+		req->fn = strdup(cf_auth_file);
+	if (!req || !req->fn) {
+		free(req);
+		log_warning("no mem for background auth_file load");
+		load_auth_file(cf_auth_file);
+		return;
+	}
+
+	err = pthread_create(&thread, NULL, auth_parse_thread, req);
+	if (err) {
+		log_warning("cannot start auth_file load thread: %s", strerror(err));
+		free(req->fn);
+		free(req);
+		load_auth_file(cf_auth_file);
+		return;
+	}
+	pthread_detach(thread);
+	reload_running = true;
+}
+
+static void auth_thread_setup(void)
+{
+	if (pipe(result_pipe) < 0)
+		fatal_perror("pipe");
+	socket_set_nonblocking(result_pipe[0], 1);
+	event_set(&ev_result, result_pipe[0], EV_READ | EV_PERSIST, auth_result_cb, NULL);
+	if (event_add(&ev_result, NULL) < 0)
+		fatal_perror("event_add");
+}
+
+#else /* !USE_AUTH_THREAD */
+
+void auth_reload_async(void)
+{
+	load_auth_file(cf_auth_file);
+}
+
+static void auth_thread_setup(void)
+{
+}
+
+#endif
+
+#ifdef USE_INOTIFY
+
+static int watch_fd = -1;
+static int watch_wd = -1;
+static struct event ev_watch;
+static char watch_dir[PATH_MAX];
+static char watch_name[PATH_MAX];
+
+/* directory is watched, so files replaced with rename() are noticed */
+static void auth_watch_cb(int fd, short flags, void *arg)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ev;
+	bool changed = false;
+	char *p;
+	int len;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)p;
+			if (ev->mask & IN_Q_OVERFLOW)
+				changed = true;
+			else if (ev->len && strcmp(ev->name, watch_name) == 0)
+				changed = true;
+		}
+	}
+
+	if (changed && cf_auth_type >= AUTH_TRUST) {
+		log_debug("auth_file changed");
+		auth_reload_async();
+	}
+}
+
+/* (re)start watching, auth_file may have changed on reload */
+void authwatch_update(void)
+{
+	char dir[PATH_MAX];
+	const char *name;
+
+	if (watch_fd < 0)
+		return;
+
+	name = strrchr(cf_auth_file, '/');
+	if (name) {
+		safe_strcpy(dir, cf_auth_file, sizeof(dir));
+		dir[name - cf_auth_file] = 0;
+		if (!dir[0])
+			strcpy(dir, "/");
+		name++;
+	} else {
+		strcpy(dir, ".");
+		name = cf_auth_file;
+	}
+
+	if (watch_wd >= 0 && strcmp(dir, watch_dir) == 0)
+		goto done;
+
+	if (watch_wd >= 0)
+		inotify_rm_watch(watch_fd, watch_wd);
+	watch_wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (watch_wd < 0) {
+		log_warning("cannot watch %s: %s, checking auth_file periodically",
+			    dir, strerror(errno));
+		return;
+	}
+	safe_strcpy(watch_dir, dir, sizeof(watch_dir));
+done:
+	safe_strcpy(watch_name, name, sizeof(watch_name));
+}
+
+bool authwatch_active(void)
+{
+	return watch_wd >= 0;
+}
+
+void authwatch_setup(void)
+{
+	auth_thread_setup();
+
+	watch_fd = inotify_init();
+	if (watch_fd < 0) {
+		log_warning("inotify_init: %s, checking auth_file periodically",
+			    strerror(errno));
+		return;
+	}
+	socket_set_nonblocking(watch_fd, 1);
+	event_set(&ev_watch, watch_fd, EV_READ | EV_PERSIST, auth_watch_cb, NULL);
+	if (event_add(&ev_watch, NULL) < 0)
+		fatal_perror("event_add");
+
+	authwatch_update();
+}
+
+#else /* !USE_INOTIFY */
+
+void authwatch_update(void)
+{
+}
+
+bool authwatch_active(void)
+{
+	return false;
+}
+
+void authwatch_setup(void)
+{
+	auth_thread_setup();
+}
+
+#endif
+
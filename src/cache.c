@@ -0,0 +1,275 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Result cache for whitelisted read-only queries.
+ *
+ * Response to simple query is captured packet by packet as it is
+ * forwarded to client and stored when server reports idle transaction
+ * state.  Later the same query from the same pool is answered from
+ * memory.  Entries are keyed on pool, client parameters and normalized
+ * query text.  Only responses that fit into pkt_buf are stored, so
+ * replay can happen with one send.
+ */
+
+#include "bouncer.h"
+
+#define CACHE_BUCKETS	256
+
+struct CacheEntry {
+	List head;		/* entry in hash bucket */
+	List lru;		/* entry in cache_lru, most recently used first */
+	PgPool *pool;
+	VarCache vars;		/* client params response was generated with */
+	usec_t expire;
+	uint32_t hash;
+	int qlen;
+	int len;		/* bytes of response */
+	int alloc_len;
+	/* query string and response data follow */
+};
+
+static List cache_buckets[CACHE_BUCKETS];
+static LIST(cache_lru);
+static int cache_bytes;
+
+#define entry_query(e) ((char *)((e) + 1))
+#define entry_data(e) ((uint8_t *)entry_query(e) + (e)->qlen + 1)
+
+void cache_setup(void)
+{
+	int i;
+	for (i = 0; i < CACHE_BUCKETS; i++)
+		list_init(&cache_buckets[i]);
+}
+
+static uint32_t cache_hash(PgPool *pool, const char *query, int qlen)
+{
+	return lookup3_hash(query, qlen) ^ ptr_hash32(pool);
+}
+
+static bool same_vars(const VarCache *a, const VarCache *b)
+{
+	return strcmp(a->client_encoding, b->client_encoding) == 0
+		&& strcmp(a->datestyle, b->datestyle) == 0
+		&& strcmp(a->timezone, b->timezone) == 0
+		&& strcmp(a->std_strings, b->std_strings) == 0
+		&& strcmp(a->read_only, b->read_only) == 0;
+}
+
+static void drop_entry(CacheEntry *e)
+{
+	list_del(&e->head);
+	list_del(&e->lru);
+	cache_bytes -= e->alloc_len;
+	e->pool->cache_entries--;
+	e->pool->cache_bytes -= e->alloc_len;
+	free(e);
+}
+
+static CacheEntry *find_entry(PgSocket *client, const char *query)
+{
+	int qlen = strlen(query);
+	uint32_t hash = cache_hash(client->pool, query, qlen);
+	List *item, *tmp;
+	CacheEntry *e;
+
+	list_for_each_safe(item, &cache_buckets[hash % CACHE_BUCKETS], tmp) {
+		e = container_of(item, CacheEntry, head);
+		if (e->hash != hash || e->pool != client->pool || e->qlen != qlen)
+			continue;
+		if (memcmp(entry_query(e), query, qlen) != 0)
+			continue;
+		if (!same_vars(&e->vars, &client->vars))
+			continue;
+		if (e->expire <= get_cached_time()) {
+			drop_entry(e);
+			return NULL;
+		}
+		return e;
+	}
+	return NULL;
+}
+
+/*
+ * Returns 1 if client was answered from cache, 0 on miss,
+ * -1 if client was dropped.
+ */
+int cache_answer(PgSocket *client, const char *query)
+{
+	PgPool *pool = client->pool;
+	CacheEntry *e;
+
+	e = find_entry(client, query);
+	if (!e) {
+		pool->cache_misses++;
+		return 0;
+	}
+	pool->cache_hits++;
+	list_del(&e->lru);
+	list_prepend(&e->lru, &cache_lru);
+
+	if (!sbuf_answer(&client->sbuf, entry_data(e), e->len)) {
+		disconnect_client(client, false, "failed to send cached result");
+		return -1;
+	}
+	return 1;
+}
+
+/* drop least recently used entries until there is room for len bytes */
+static bool make_room(int len)
+{
+	CacheEntry *e;
+
+	if (len > cf_cache_max_size)
+		return false;
+	while (cache_bytes + len > cf_cache_max_size && !list_empty(&cache_lru)) {
+		e = container_of(cache_lru.prev, CacheEntry, lru);
+		drop_entry(e);
+	}
+	return true;
+}
+
+void cache_fill_start(PgSocket *server, const char *query)
+{
+	int qlen = strlen(query);
+	PgSocket *client = server->link;
+	CacheEntry *e;
+
+	cache_fill_abort(server);
+	if (cf_cache_ttl <= 0 || cf_cache_max_size <= 0)
+		return;
+
+	e = malloc(sizeof(*e) + qlen + 1 + cf_sbuf_len);
+	if (!e)
+		return;
+	list_init(&e->head);
+	list_init(&e->lru);
+	e->pool = client->pool;
+	e->vars = client->vars;
+	e->hash = cache_hash(client->pool, query, qlen);
+	e->qlen = qlen;
+	e->len = 0;
+	memcpy(entry_query(e), query, qlen + 1);
+	server->cache_fill = e;
+}
+
+void cache_fill_abort(PgSocket *server)
+{
+	if (server->cache_fill) {
+		free(server->cache_fill);
+		server->cache_fill = NULL;
+	}
+}
+
+static void cache_fill_finish(PgSocket *server)
+{
+	CacheEntry *e = server->cache_fill;
+	CacheEntry *old;
+	PgPool *pool = e->pool;
+	void *tmp;
+
+	server->cache_fill = NULL;
+
+	/* another client may have filled it meanwhile */
+	old = find_entry(server->link, entry_query(e));
+	if (old)
+		drop_entry(old);
+
+	e->alloc_len = sizeof(*e) + e->qlen + 1 + e->len;
+	if (!make_room(e->alloc_len)) {
+		free(e);
+		return;
+	}
+	tmp = realloc(e, e->alloc_len);
+	if (tmp)
+		e = tmp;
+	list_init(&e->head);
+	list_init(&e->lru);
+	e->expire = get_cached_time() + cf_cache_ttl;
+
+	list_append(&e->head, &cache_buckets[e->hash % CACHE_BUCKETS]);
+	list_prepend(&e->lru, &cache_lru);
+	cache_bytes += e->alloc_len;
+	pool->cache_entries++;
+	pool->cache_bytes += e->alloc_len;
+}
+
+/*
+ * Called for each server packet when response is being captured.
+ * Anything besides plain result set or partial packets cancels it.
+ */
+void cache_fill_packet(PgSocket *server, PktHdr *pkt)
+{
+	CacheEntry *e = server->cache_fill;
+
+	if (!server->link || server->link->pool != e->pool)
+		goto abort;
+	if (incomplete_pkt(pkt) || e->len + pkt->len > (unsigned)cf_sbuf_len)
+		goto abort;
+
+	switch (pkt->type) {
+	case 'T':		/* RowDescription */
+	case 'D':		/* DataRow */
+	case 'C':		/* CommandComplete */
+	case 'I':		/* EmptyQueryResponse */
+		break;
+	case 'Z':		/* ReadyForQuery */
+		if (server->tx_state != 'I')
+			goto abort;
+		break;
+	default:
+		goto abort;
+	}
+
+	memcpy(entry_data(e) + e->len, pkt->data.data, pkt->len);
+	e->len += pkt->len;
+	if (pkt->type == 'Z')
+		cache_fill_finish(server);
+	return;
+abort:
+	cache_fill_abort(server);
+}
+
+void cache_purge_pool(PgPool *pool)
+{
+	List *item, *tmp;
+	CacheEntry *e;
+
+	list_for_each_safe(item, &cache_lru, tmp) {
+		e = container_of(item, CacheEntry, lru);
+		if (e->pool == pool)
+			drop_entry(e);
+	}
+}
+
+/* drop expired entries, also apply lowered cache_max_size */
+void cache_maint(void)
+{
+	usec_t now = get_cached_time();
+	List *item, *tmp;
+	CacheEntry *e;
+
+	list_for_each_safe(item, &cache_lru, tmp) {
+		e = container_of(item, CacheEntry, lru);
+		if (e->expire <= now)
+			drop_entry(e);
+	}
+	make_room(0);
+}
+
@@ -49,8 +49,23 @@ static bool check_client_passwd(PgSocket *client, const char *passwd)
 	return false;
 }
 
-bool set_pool(PgSocket *client, const char *dbname, const char *username)
+/* pool for read-only work, NULL if db has no usable replica */
+static PgPool *get_replica_pool(PgSocket *client, PgDatabase *db)
 {
+	PgDatabase *replica;
+
+	if (!db->replica_name[0])
+		return NULL;
+	replica = find_database(db->replica_name);
+	if (!replica || replica == db || replica->admin)
+		return NULL;
+	return get_pool(replica, replica->forced_user ? replica->forced_user : client->auth_user);
+}
+
+bool set_pool(PgSocket *client, const char *dbname, const char *username, bool read_only, bool takeover)
+{
+	PgPool *replica;
+
 	PgDatabase *db;
 	PgUser *user;
 
@@ -81,6 +96,14 @@ bool set_pool(PgSocket *client, const char *dbname, const char *username)
 	} else {
 		/* the user clients wants to log in as */
 		user = find_user(username);
+		if (takeover) {
+			/* old process has authenticated it */
+			if (!user)
+				user = auth_query_user(username);
+		} else if (!user || user->from_query) {
+			if (!auth_query_lookup(client, db, username, &user))
+				return false;
+		}
 		if (!user) {
 			disconnect_client(client, true, "No such user");
 			return false;
@@ -97,6 +120,27 @@ bool set_pool(PgSocket *client, const char *dbname, const char *username)
 		return false;
 	}
 
+	/* read-only session goes to replica, others may route per transaction */
+	replica = get_replica_pool(client, db);
+	if (replica && read_only) {
+		slog_debug(client, "read-only session, using %s", replica->db->name);
+		client->pool = replica;
+	} else if (replica) {
+		client->home_pool = client->pool;
+		client->pool->has_routed = 1;
+	}
+
+	if (!db->admin)
+		client->sbuf.budget = &client->pool->loop_budget;
+
+	/* place in waiting queue */
+	if (strlist_contains(cf_priority_users, client->auth_user->name))
+		client->wait_class = WAIT_PRIORITY;
+	else if (strlist_contains(cf_batch_users, client->auth_user->name))
+		client->wait_class = WAIT_BATCH;
+	else
+		client->wait_class = WAIT_NORMAL;
+
 	if (db->max_client_conn >= 0 && get_pool_client_count(client->pool) >= db->max_client_conn) {
 		if (strcmp(dbname, "pgbouncer") != 0) {
 			disconnect_client(client, true, "no more connections allowed for pool");
@@ -107,10 +151,34 @@ bool set_pool(PgSocket *client, const char *dbname, const char *username)
 	return true;
 }
 
+/* does requested database route read-only work to replica */
+static bool startup_db_has_replica(PktHdr *pkt)
+{
+	MBuf data = pkt->data;
+	const char *key, *val;
+	PgDatabase *db;
+
+	while (1) {
+		key = mbuf_get_string(&data);
+		if (!key || *key == 0)
+			break;
+		val = mbuf_get_string(&data);
+		if (!val)
+			break;
+		if (strcmp(key, "database") == 0) {
+			db = find_database(val);
+			return db && db->replica_name[0];
+		}
+	}
+	return false;
+}
+
 static bool decide_startup_pool(PgSocket *client, PktHdr *pkt)
 {
 	const char *username = NULL, *dbname = NULL;
 	const char *key, *val;
+	bool read_only = false;
+	bool replica = startup_db_has_replica(pkt);
 
 	while (1) {
 		key = mbuf_get_string(&pkt->data);
@@ -124,7 +192,12 @@ static bool decide_startup_pool(PgSocket *client, PktHdr *pkt)
 			dbname = val;
 		else if (strcmp(key, "user") == 0)
 			username = val;
-		else if (varcache_set(&client->vars, key, val))
+		else if (replica && varcache_set_local(&client->vars, key, val)) {
+			/* decides pool, and is applied on server too */
+			if (strcmp(key, "default_transaction_read_only") == 0)
+				read_only = strcasecmp(val, "on") == 0 || strcasecmp(val, "true") == 0
+					|| strcasecmp(val, "yes") == 0 || strcmp(val, "1") == 0;
+		} else if (varcache_set(&client->vars, key, val))
 			slog_debug(client, "got var: %s=%s", key, val);
 		else if (strlist_contains(cf_ignore_startup_params, key)) {
 			slog_debug(client, "ignoring startup parameter: %s=%s", key, val);
@@ -154,12 +227,13 @@ static bool decide_startup_pool(PgSocket *client, PktHdr *pkt)
 	}
 
 	/* find pool and log about it */
-	if (set_pool(client, dbname, username)) {
+	if (set_pool(client, dbname, username, read_only, false)) {
 		if (cf_log_connections)
 			slog_info(client, "login successful: db=%s user=%s", dbname, username);
 		return true;
 	} else {
-		if (cf_log_connections)
+		/* no result yet if waiting for auth_query */
+		if (cf_log_connections && !client->wait_for_user)
 			slog_info(client, "login failed: db=%s user=%s", dbname, username);
 		return false;
 	}
@@ -207,6 +281,11 @@ static bool handle_client_startup(PgSocket *client, PktHdr *pkt)
 		return false;
 	}
 
+	if (client->wait_for_user) {
+		auth_query_continue(client);
+		return false;
+	}
+
 	if (client->wait_for_welcome) {
 		if  (finish_client_login(client)) {
 			/* the packet was already parsed */
@@ -284,10 +363,367 @@ static bool handle_client_startup(PgSocket *client, PktHdr *pkt)
 	return true;
 }
 
+/*
+ * Statement pooling: detect queries that try to open a transaction.
+ */
+
+static inline bool is_ident_char(unsigned char c)
+{
+	return isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+/* match keyword at statement start, case-insensitively */
+static int match_tx_word(const char *p, const char *end, const char *word)
+{
+	while (*word) {
+		if (p >= end)
+			return -1;
+		if (tolower((unsigned char)*p) != *word)
+			return 0;
+		p++;
+		word++;
+	}
+	if (p >= end)
+		return -1;
+	return is_ident_char(*p) ? 0 : 1;
+}
+
+/*
+ * Scan query string for statements starting with BEGIN or START.
+ *
+ * Quotes, dollar-quotes and comments are skipped, so function
+ * bodies do not trigger it.  Returns 1 if found, 0 if not and
+ * -1 if the buffered part of query ended before it was decided.
+ */
+static int query_opens_tx(const char *q, const char *end)
+{
+	bool stmt_start = true;
+	const char *p = q, *tag;
+	unsigned char c;
+	int res, taglen;
+
+	while (p < end) {
+		c = *p;
+		if (c == 0)
+			return 0;
+		if (c == ';') {
+			stmt_start = true;
+			p++;
+		} else if (isspace(c)) {
+			p++;
+		} else if (c == '-' || c == '/') {
+			if (p + 1 >= end)
+				return -1;
+			if (c == '-' && p[1] == '-') {
+				p = memchr(p, '\n', end - p);
+				if (!p)
+					return -1;
+			} else if (c == '/' && p[1] == '*') {
+				for (p += 2; p + 1 < end; p++) {
+					if (p[0] == '*' && p[1] == '/')
+						break;
+				}
+				if (p + 1 >= end)
+					return -1;
+				p += 2;
+			} else {
+				stmt_start = false;
+				p++;
+			}
+		} else if (c == '\'' || c == '"') {
+			/* backslash escapes only in E'' strings */
+			bool esc = c == '\'' && p > q && (p[-1] == 'E' || p[-1] == 'e')
+				&& (p - 1 == q || !is_ident_char(p[-2]));
+			for (p++; p < end && *p != c; p++) {
+				if (esc && *p == '\\')
+					p++;
+			}
+			if (p >= end)
+				return -1;
+			stmt_start = false;
+			p++;
+		} else if (c == '$' && (p == q || !is_ident_char(p[-1]))
+			   && p + 1 < end && !isdigit((unsigned char)p[1])) {
+			/* dollar-quoted string: $tag$ ... $tag$ */
+			tag = p++;
+			while (p < end && *p != '$' && is_ident_char(*p))
+				p++;
+			if (p >= end)
+				return -1;
+			if (*p != '$') {
+				stmt_start = false;
+				continue;
+			}
+			taglen = ++p - tag;
+			while (p + taglen <= end && memcmp(p, tag, taglen) != 0)
+				p++;
+			if (p + taglen > end)
+				return -1;
+			p += taglen;
+			stmt_start = false;
+		} else if (stmt_start) {
+			res = match_tx_word(p, end, "begin");
+			if (res == 0)
+				res = match_tx_word(p, end, "start");
+			if (res != 0)
+				return res;
+			stmt_start = false;
+			p++;
+		} else {
+			while (p < end && is_ident_char(*p))
+				p++;
+			if (!is_ident_char(c))
+				p++;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Under statement pooling refuse queries that would open transaction.
+ *
+ * Only unlinked client is checked - a linked one has server results
+ * coming in, so error cannot be injected.  That case, and queries too
+ * big to scan fully, are left to the ReadyForQuery check in server.c.
+ *
+ * Returns 1 if refused, 0 if ok and -1 to wait for more data.
+ */
+static int check_stmt_query(PgSocket *client, PktHdr *pkt)
+{
+	MBuf body;
+	const char *q;
+	int res;
+
+	if (cf_pool_mode != POOL_STMT || client->link)
+		return 0;
+
+	mbuf_copy(&pkt->data, &body);
+	if (pkt->type == 'P' && !mbuf_get_string(&body))
+		goto need_more;
+	q = (const char *)body.pos;
+	res = query_opens_tx(q, q + mbuf_avail(&body));
+	if (res >= 0)
+		return res;
+need_more:
+	if (incomplete_pkt(pkt) && pkt->len <= SBUF_SMALL_PKT)
+		return -1;
+	return 0;
+}
+
+/*
+ * Replica routing: does first statement look like
+ * BEGIN/START TRANSACTION ... READ ONLY.
+ */
+
+static bool word_is(const char *w, int len, const char *word)
+{
+	return len == (int)strlen(word) && strncasecmp(w, word, len) == 0;
+}
+
+static bool query_begins_read_only(const char *p, const char *end)
+{
+	const char *w;
+	bool first = true, prev_read = false;
+	int len;
+
+	while (p < end && *p && *p != ';') {
+		if (p[0] == '-' && p + 1 < end && p[1] == '-') {
+			p = memchr(p, '\n', end - p);
+			if (!p)
+				return false;
+		} else if (p[0] == '/' && p + 1 < end && p[1] == '*') {
+			for (p += 2; p + 1 < end; p++) {
+				if (p[0] == '*' && p[1] == '/')
+					break;
+			}
+			if (p + 1 >= end)
+				return false;
+			p += 2;
+		} else if (*p == '\'' || *p == '"') {
+			/* no quotes in BEGIN */
+			return false;
+		} else if (!is_ident_char(*p)) {
+			p++;
+		} else {
+			w = p;
+			while (p < end && is_ident_char(*p))
+				p++;
+			if (p >= end)
+				return false;
+			len = p - w;
+			if (first) {
+				if (!word_is(w, len, "begin") && !word_is(w, len, "start"))
+					return false;
+				first = false;
+			} else if (prev_read && word_is(w, len, "only"))
+				return true;
+			prev_read = word_is(w, len, "read");
+		}
+	}
+	return false;
+}
+
+/*
+ * Pick pool for transaction that starts with this packet.  Only unlinked
+ * client can be moved, so it works in transaction and statement pooling.
+ * Partial packets are routed to primary, that is always safe.
+ */
+static void route_client(PgSocket *client, PktHdr *pkt)
+{
+	PgPool *pool = client->home_pool;
+	PgPool *replica;
+	MBuf body;
+	const char *q;
+
+	if (client->link || cf_pool_mode == POOL_SESSION)
+		return;
+
+	mbuf_copy(&pkt->data, &body);
+	if (pkt->type == 'P' && !mbuf_get_string(&body))
+		goto done;
+	q = (const char *)body.pos;
+	if (query_begins_read_only(q, q + mbuf_avail(&body))) {
+		replica = get_replica_pool(client, pool->db);
+		if (replica)
+			pool = replica;
+	}
+done:
+	if (pool != client->pool)
+		slog_debug(client, "routing to %s", pool->db->name);
+	switch_client_pool(client, pool);
+}
+
+/*
+ * Health-check queries from local_queries are answered without server.
+ */
+
+/* returns 1 if answered, 0 if should go to server, -1 to wait for more data */
+static int answer_local_query(PgSocket *client, PktHdr *pkt)
+{
+	char q[MAX_LOCAL_QUERY];
+	char val[16];
+	uint8_t tmp[128];
+	PktBuf buf;
+	MBuf body;
+	int len;
+
+	if (!*cf_local_queries || client->link)
+		return 0;
+	if (incomplete_pkt(pkt))
+		return pkt->len <= SBUF_SMALL_PKT ? -1 : 0;
+
+	mbuf_copy(&pkt->data, &body);
+	len = normalize_query(q, sizeof(q), (const char *)body.pos, mbuf_avail(&body));
+	if (len < 0 || (len > 0 && !querylist_contains(cf_local_queries, q)))
+		return 0;
+
+	pktbuf_static(&buf, tmp, sizeof(tmp));
+	if (len == 0) {
+		/* empty query */
+		pktbuf_write_generic(&buf, 'I', "");
+	} else {
+		/* list contains only SELECT <int>, show it as server would */
+		len = snprintf(val, sizeof(val), "%d", atoi(q + 7));
+		pktbuf_write_RowDescription(&buf, "i", "?column?");
+		pktbuf_write_generic(&buf, 'D', "hib", 1, len, val, len);
+		pktbuf_write_CommandComplete(&buf, "SELECT 1");
+	}
+	pktbuf_write_ReadyForQuery(&buf);
+
+	client->query_start = 0;
+	client->cur_query_start = 0;
+	sbuf_prepare_skip(&client->sbuf, pkt->len);
+	if (!pktbuf_send_immidiate(&buf, client)) {
+		disconnect_client(client, false, "failed to answer local query");
+		return -1;
+	}
+	return 1;
+}
+
+/*
+ * Check result cache for whitelisted query.  Returns same as
+ * answer_local_query().  On miss the query is left in 'key'
+ * so the response can be captured.
+ */
+static int answer_cached_query(PgSocket *client, PktHdr *pkt, char *key)
+{
+	MBuf body;
+	int len, res;
+
+	if (!*cf_cache_queries || client->link)
+		return 0;
+	if (incomplete_pkt(pkt))
+		return pkt->len <= SBUF_SMALL_PKT ? -1 : 0;
+
+	mbuf_copy(&pkt->data, &body);
+	len = normalize_query(key, MAX_CACHE_QUERY, (const char *)body.pos, mbuf_avail(&body));
+	if (len <= 0 || !querylist_contains(cf_cache_queries, key)) {
+		key[0] = 0;
+		return 0;
+	}
+
+	res = cache_answer(client, key);
+	if (res == 0)
+		return 0;
+	key[0] = 0;
+	if (res > 0) {
+		client->query_start = 0;
+		client->cur_query_start = 0;
+		sbuf_prepare_skip(&client->sbuf, pkt->len);
+	}
+	return res;
+}
+
+/*
+ * Remember start of query for slow log.  Takes what is in buffer,
+ * so long query may be cut even before SLOW_QUERY_TEXT.
+ */
+static void save_query_text(PgSocket *client, PktHdr *pkt)
+{
+	const uint8_t *p = pkt->data.pos;
+	const uint8_t *nul;
+	unsigned i, avail = mbuf_avail(&pkt->data);
+
+	/* Parse: skip statement name */
+	if (pkt->type == 'P') {
+		nul = memchr(p, 0, avail);
+		if (!nul)
+			return;
+		avail -= nul + 1 - p;
+		p = nul + 1;
+	}
+
+	for (i = 0; i < avail && i < SLOW_QUERY_TEXT - 1 && p[i]; i++)
+		client->query_text[i] = p[i] < ' ' ? ' ' : p[i];
+	client->query_text[i] = 0;
+}
+
 /* decide on packets of logged-in client */
 static bool handle_client_work(PgSocket *client, PktHdr *pkt)
 {
 	SBuf *sbuf = &client->sbuf;
+	char cache_key[MAX_CACHE_QUERY];
+	int res;
+
+	/* rest of refused extended-protocol batch */
+	if (client->skip_until_sync) {
+		switch (pkt->type) {
+		case 'S':
+			client->skip_until_sync = 0;
+			sbuf_prepare_skip(sbuf, pkt->len);
+			SEND_ReadyForQuery(res, client);
+			if (!res) {
+				disconnect_client(client, false, "failed to send ReadyForQuery");
+				return false;
+			}
+			return true;
+		case 'X':
+			break;
+		default:
+			sbuf_prepare_skip(sbuf, pkt->len);
+			return true;
+		}
+	}
 
 	switch (pkt->type) {
 
@@ -317,21 +753,73 @@ static bool handle_client_work(PgSocket *client, PktHdr *pkt)
 		/* update stats */
 		if (!client->query_start) {
 			client->pool->stats.request_count++;
+			client->stats.request_count++;
 			client->query_start = get_cached_time();
+			client->query_text[0] = 0;
 		}
+		if (!client->cur_query_start)
+			client->cur_query_start = get_cached_time();
+		if ((pkt->type == 'Q' || pkt->type == 'P') && !client->query_text[0]
+		    && (cf_log_slow_wait || cf_log_slow_query || cf_log_slow_xact))
+			save_query_text(client, pkt);
 
 		if (client->pool->db->admin)
 			return admin_handle_client(client, pkt);
 
+		if (pkt->type == 'Q') {
+			res = answer_local_query(client, pkt);
+			if (res != 0)
+				return res > 0;
+		}
+
+		if (pkt->type == 'Q' || pkt->type == 'P') {
+			res = check_stmt_query(client, pkt);
+			if (res < 0)
+				return false;
+			if (res > 0) {
+				client->query_start = 0;
+				client->cur_query_start = 0;
+				sbuf_prepare_skip(sbuf, pkt->len);
+				if (pkt->type == 'P')
+					client->skip_until_sync = 1;
+				if (!send_pooler_error(client, pkt->type == 'Q',
+						       "Transactions not allowed in statement pooling mode")) {
+					disconnect_client(client, false, "failed to send error");
+					return false;
+				}
+				return true;
+			}
+		}
+
+		if (client->home_pool && (pkt->type == 'Q' || pkt->type == 'P'))
+			route_client(client, pkt);
+
+		cache_key[0] = 0;
+		if (pkt->type == 'Q') {
+			res = answer_cached_query(client, pkt, cache_key);
+			if (res != 0)
+				return res > 0;
+		}
+
 		/* aquire server */
 		if (!find_server(client))
 			return false;
 
+		if (cache_key[0])
+			cache_fill_start(client->link, cache_key);
+
 		client->pool->stats.client_bytes += pkt->len;
+		client->stats.client_bytes += pkt->len;
+		if (!client->xact_start)
+			client->xact_start = get_cached_time();
 
 		/* tag the server as dirty */
 		client->link->ready = 0;
 
+		/* each of these gets own ReadyForQuery */
+		if (pkt->type == 'Q' || pkt->type == 'S' || pkt->type == 'F')
+			client->link->rfq_pending++;
+
 		/* forward the packet */
 		sbuf_prepare_send(sbuf, &client->link->sbuf, pkt->len);
 		break;
@@ -364,6 +852,9 @@ bool client_proto(SBuf *sbuf, SBufEvent evtype, MBuf *data)
 	if (client->state == CL_JUSTFREE)
 		return false;
 
+	if (evtype != SBUF_EV_READ)
+		trace_event(client, 'C', evtype, NULL);
+
 	switch (evtype) {
 	case SBUF_EV_CONNECT_OK:
 	case SBUF_EV_CONNECT_FAILED:
@@ -385,6 +876,7 @@ bool client_proto(SBuf *sbuf, SBufEvent evtype, MBuf *data)
 			return false;
 		}
 		slog_noise(client, "pkt='%c' len=%d", pkt_desc(&pkt), pkt.len);
+		trace_event(client, 'C', evtype, &pkt);
 
 		client->request_time = get_cached_time();
 		switch (client->state) {
@@ -392,7 +884,7 @@ bool client_proto(SBuf *sbuf, SBufEvent evtype, MBuf *data)
 			res = handle_client_startup(client, &pkt);
 			break;
 		case CL_ACTIVE:
-			if (client->wait_for_welcome)
+			if (client->wait_for_welcome || client->wait_for_user)
 				res = handle_client_startup(client, &pkt);
 			else
 				res = handle_client_work(client, &pkt);
@@ -0,0 +1,221 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Host name lookups.
+ *
+ * With getaddrinfo_a() the lookups run in resolver threads and
+ * completion is signalled to event loop via pipe.  Without it,
+ * blocking getaddrinfo() is used.  Resolving goes through the
+ * usual system resolver, so /etc/hosts entries work as well.
+ */
+
+#include "bouncer.h"
+
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+#ifdef HAVE_GETADDRINFO_A
+#include <signal.h>
+#endif
+
+/* apply lookup result to host */
+static void dns_result(PgHost *host, struct addrinfo *res, int err)
+{
+	struct sockaddr_in *sa;
+	struct addrinfo *ai;
+	usec_t now = get_cached_time();
+
+	host->dns_pending = 0;
+
+	for (ai = res; !err && ai; ai = ai->ai_next) {
+		if (ai->ai_family != AF_INET)
+			continue;
+		sa = (struct sockaddr_in *)ai->ai_addr;
+		host_set_addr(host, sa->sin_addr.s_addr);
+		host->dns_failed = 0;
+		host->dns_expire = now + cf_dns_max_ttl;
+		log_debug("host %s resolved to %s", host->name,
+			  inet_ntoa(host->addr.ip_addr));
+		return;
+	}
+
+	/* keep old address, if any */
+	log_warning("DNS lookup failed: %s: %s", host->name,
+		    err ? gai_strerror(err) : "no IPv4 address");
+	host->dns_failed = 1;
+	host->dns_expire = now + cf_server_login_retry;
+	if (!host_resolved(host))
+		kill_unresolved_logins();
+}
+
+#ifdef HAVE_GETADDRINFO_A
+
+struct DNSRequest {
+	List head;
+	PgHost *host;
+	struct gaicb gai;
+	struct addrinfo hints;
+};
+
+static STATLIST(dns_pending_list);
+
+static int notify_pipe[2] = { -1, -1 };
+static struct event ev_notify;
+
+/* runs in resolver thread */
+static void dns_notify(union sigval sv)
+{
+	int res;
+	do {
+		res = write(notify_pipe[1], "", 1);
+	} while (res < 0 && errno == EINTR);
+}
+
+/* finished lookups are collected in main thread */
+static void dns_notify_cb(int fd, short flags, void *arg)
+{
+	struct DNSRequest *req;
+	List *item, *tmp;
+	char buf[64];
+	int err;
+
+	while (read(fd, buf, sizeof(buf)) > 0);
+
+	statlist_for_each_safe(item, &dns_pending_list, tmp) {
+		req = container_of(item, struct DNSRequest, head);
+		err = gai_error(&req->gai);
+		if (err == EAI_INPROGRESS)
+			continue;
+		statlist_remove(&req->head, &dns_pending_list);
+		dns_result(req->host, req->gai.ar_result, err);
+		if (req->gai.ar_result)
+			freeaddrinfo(req->gai.ar_result);
+		host_unref(req->host);
+		free(req);
+	}
+}
+
+static void dns_start(PgHost *host)
+{
+	struct DNSRequest *req;
+	struct gaicb *list[1];
+	struct sigevent sev;
+	int err;
+
+	req = calloc(1, sizeof(*req));
+	if (!req) {
+		log_warning("dns_start: no mem");
+		return;
+	}
+	list_init(&req->head);
+	req->hints.ai_family = AF_INET;
+	req->hints.ai_socktype = SOCK_STREAM;
+	req->gai.ar_name = host->name;
+	req->gai.ar_request = &req->hints;
+	list[0] = &req->gai;
+
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD;
+	sev.sigev_notify_function = dns_notify;
+
+	err = getaddrinfo_a(GAI_NOWAIT, list, 1, &sev);
+	if (err) {
+		free(req);
+		dns_result(host, NULL, err);
+		return;
+	}
+
+	/* name buffer must stay around until lookup finishes */
+	req->host = host;
+	host->refcount++;
+	host->dns_pending = 1;
+	statlist_append(&req->head, &dns_pending_list);
+}
+
+void dns_setup(void)
+{
+	if (pipe(notify_pipe) < 0)
+		fatal_perror("pipe");
+	socket_set_nonblocking(notify_pipe[0], 1);
+	socket_set_nonblocking(notify_pipe[1], 1);
+	event_set(&ev_notify, notify_pipe[0], EV_READ | EV_PERSIST, dns_notify_cb, NULL);
+	if (event_add(&ev_notify, NULL) < 0)
+		fatal_perror("event_add");
+
+	dns_maint();
+}
+
+#else /* !HAVE_GETADDRINFO_A */
+
+static void dns_start(PgHost *host)
+{
+	struct addrinfo hints, *res = NULL;
+	int err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	err = getaddrinfo(host->name, NULL, &hints, &res);
+	dns_result(host, res, err);
+	if (res)
+		freeaddrinfo(res);
+}
+
+void dns_setup(void)
+{
+	List *item;
+	PgHost *host;
+
+	statlist_for_each(item, &host_list) {
+		host = container_of(item, PgHost, head);
+		if (!host->is_ip) {
+			log_warning("getaddrinfo_a() not available, host names are"
+				    " resolved with blocking getaddrinfo()");
+			break;
+		}
+	}
+	dns_maint();
+}
+
+#endif
+
+/*
+ * Start lookups for new hosts and ones whose address has expired.
+ * Called periodically from janitor.
+ */
+void dns_maint(void)
+{
+	List *item;
+	PgHost *host;
+	usec_t now = get_cached_time();
+
+	statlist_for_each(item, &host_list) {
+		host = container_of(item, PgHost, head);
+		if (host->is_ip || host->dns_pending)
+			continue;
+		if (host->dns_expire) {
+			if (!cf_dns_max_ttl && !host->dns_failed)
+				continue;
+			if (now < host->dns_expire)
+				continue;
+		}
+		dns_start(host);
+	}
+}
+
@@ -0,0 +1,269 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Backend hosts and load balancing between them.
+ *
+ * Hosts are shared between databases, so the connection
+ * counts reflect all pools that use the host.
+ */
+
+#include "bouncer.h"
+
+STATLIST(host_list);
+
+static ObjectCache *host_cache;
+
+void init_hosts(void)
+{
+	host_cache = objcache_create("host_cache", sizeof(PgHost), 0, NULL);
+	if (!host_cache)
+		fatal("cannot create host cache");
+}
+
+/*
+ * Find host by name and port, or create new one.
+ *
+ * If addr is INADDR_NONE, the name needs DNS lookup.  It is done
+ * asynchronously, existing host keeps old address until then.
+ */
+PgHost *host_get(const char *name, int port, in_addr_t addr)
+{
+	List *item;
+	PgHost *host;
+
+	statlist_for_each(item, &host_list) {
+		host = container_of(item, PgHost, head);
+		if (host->addr.port == port && strcmp(host->name, name) == 0)
+			goto found;
+	}
+
+	host = obj_alloc(host_cache);
+	if (!host)
+		return NULL;
+	list_init(&host->head);
+	safe_strcpy(host->name, name, sizeof(host->name));
+	host->addr.port = port;
+	host->addr.ip_addr.s_addr = INADDR_NONE;
+	statlist_append(&host->head, &host_list);
+found:
+	if (addr != INADDR_NONE) {
+		host->is_ip = 1;
+		host_set_addr(host, addr);
+	} else {
+		/* re-resolve on reload */
+		host->is_ip = 0;
+		host->dns_expire = 0;
+	}
+	host->refcount++;
+	return host;
+}
+
+bool host_resolved(const PgHost *host)
+{
+	return host->addr.ip_addr.s_addr != INADDR_NONE;
+}
+
+/* take new address into use, old connections are dropped */
+void host_set_addr(PgHost *host, in_addr_t addr)
+{
+	bool had_addr = host_resolved(host);
+
+	if (host->addr.ip_addr.s_addr == addr)
+		return;
+	host->addr.ip_addr.s_addr = addr;
+	if (had_addr && host->refcount > 0) {
+		log_info("host %s:%d address changed to %s", host->name,
+			 host->addr.port, inet_ntoa(host->addr.ip_addr));
+		tag_host_dirty(host);
+	} else if (!had_addr) {
+		adopt_host_servers(host);
+	}
+}
+
+/* database has hosts, but none has address and their lookups failed */
+bool hosts_unresolved(const PgDatabase *db)
+{
+	const PgHost *host;
+	int i;
+
+	for (i = 0; i < db->host_count; i++) {
+		host = db->hosts[i];
+		if (host_resolved(host) || !host->dns_failed)
+			return false;
+	}
+	return db->host_count > 0;
+}
+
+void host_unref(PgHost *host)
+{
+	Assert(host->refcount > 0);
+	if (--host->refcount > 0)
+		return;
+	statlist_remove(&host->head, &host_list);
+	obj_free(host_cache, host);
+}
+
+/* is host a less loaded than b */
+bool host_better(const PgHost *a, const PgHost *b)
+{
+	if (a->active_count != b->active_count)
+		return a->active_count < b->active_count;
+	return a->conn_count < b->conn_count;
+}
+
+/*
+ * Pick best host in range for new connection.
+ *
+ * Healthy hosts are preferred, then suspect ones.  Down host
+ * is returned only if its retry time has passed, as probe.
+ * Search starts from different host each time, so ties
+ * are broken in round-robin fashion.
+ */
+static PgHost *pick_from(PgDatabase *db, int first, int n, usec_t now)
+{
+	PgHost *best = NULL, *probe = NULL, *host;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		host = db->hosts[first + (db->host_rr + i) % n];
+		if (!host_resolved(host))
+			continue;
+		if (host->state == HOST_DOWN) {
+			if (!probe && now >= host->retry_time)
+				probe = host;
+		} else if (!best || host->state < best->state
+			   || (host->state == best->state && host_better(host, best)))
+			best = host;
+	}
+	return best ? best : probe;
+}
+
+/* standby hosts are used only if no primary is usable, unresolved are skipped */
+PgHost *pick_host(PgDatabase *db)
+{
+	PgHost *host;
+	usec_t now = get_cached_time();
+
+	if (db->host_count == 0)
+		return NULL;
+	db->host_rr++;
+	host = pick_from(db, 0, db->primary_count, now);
+	if (!host && db->host_count > db->primary_count)
+		host = pick_from(db, db->primary_count,
+				 db->host_count - db->primary_count, now);
+	return host;
+}
+
+/*
+ * Exponential backoff is only useful when database has other hosts
+ * to use meanwhile, otherwise retry after server_login_retry.
+ */
+static usec_t host_backoff(PgHost *host, PgDatabase *db)
+{
+	int shift = host->fail_count - 1;
+	if (db->host_count <= 1)
+		return cf_server_login_retry;
+	if (shift > HOST_MAX_BACKOFF_SHIFT)
+		shift = HOST_MAX_BACKOFF_SHIFT;
+	return cf_server_login_retry << shift;
+}
+
+/* track server connection on host */
+void host_server_add(PgHost *host, PgSocket *server)
+{
+	Assert(!server->host);
+	server->host = host;
+	host->refcount++;
+	host->conn_count++;
+
+	/* probing down host, others should wait for result */
+	if (host->state == HOST_DOWN)
+		host->retry_time = get_cached_time() + host_backoff(host, server->pool->db);
+}
+
+void host_server_drop(PgSocket *server)
+{
+	PgHost *host = server->host;
+
+	if (!host)
+		return;
+	server->host = NULL;
+	host->conn_count--;
+	host_unref(host);
+}
+
+/*
+ * Health state is shared by all pools using the host,
+ * so one failed connect is enough for all of them to switch.
+ */
+
+/* could not connect or log in */
+void host_failed(PgSocket *server)
+{
+	PgHost *host = server->host;
+	PgDatabase *db = server->pool->db;
+
+	host->fail_count++;
+	host->retry_time = get_cached_time() + host_backoff(host, db);
+	if (host->state != HOST_DOWN) {
+		log_warning("host %s:%d is down, retry in %llu s",
+			    host->name, host->addr.port,
+			    (unsigned long long)(host->retry_time - get_cached_time()) / USEC);
+		host->state = HOST_DOWN;
+
+		/*
+		 * Rest of connections are probably dead too, but with
+		 * single host keep them, as there is nowhere to switch.
+		 */
+		if (db->host_count > 1)
+			tag_host_dirty(host);
+	}
+}
+
+/* established connection dropped unexpectedly */
+void host_crashed(PgHost *host)
+{
+	if (host->state == HOST_UP) {
+		log_info("host %s:%d is suspect", host->name, host->addr.port);
+		host->state = HOST_SUSPECT;
+	}
+}
+
+/* successful login */
+void host_ok(PgHost *host)
+{
+	if (host->state != HOST_UP)
+		log_info("host %s:%d is up", host->name, host->addr.port);
+	host->state = HOST_UP;
+	host->fail_count = 0;
+	host->retry_time = 0;
+}
+
+const char *host_state_name(const PgHost *host)
+{
+	switch (host->state) {
+	case HOST_UP:
+		return "up";
+	case HOST_SUSPECT:
+		return "suspect";
+	default:
+		return "down";
+	}
+}
+
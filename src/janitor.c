@@ -270,6 +270,7 @@ void per_loop_maint(void)
 		pool = container_of(item, PgPool, head);
 		if (pool->db->admin)
 			continue;
+		reset_pool_budget(pool);
 		switch (cf_pause_mode) {
 		case P_NONE:
 			if (pool->db->db_paused) {
@@ -450,8 +451,11 @@ static void pool_server_maint(PgPool *pool)
 			Assert(server->state == SV_LOGIN);
 
 			age = now - server->connect_time;
-			if (age > cf_server_connect_timeout)
+			if (age > cf_server_connect_timeout) {
+				if (server->host)
+					host_failed(server);
 				disconnect_server(server, true, "connect timeout");
+			}
 		}
 	}
 
@@ -519,6 +523,16 @@ static void do_full_maint(int sock, short flags, void *arg)
 
 	cleanup_inactive_autodatabases();
 
+	dns_maint();
+
+	cache_maint();
+
+	auth_query_maint();
+
+	metrics_setup();
+
+	shmstats_update();
+
 	cleanup_client_logins();
 
 	if (cf_shutdown == 1 && get_active_server_count() == 0) {
@@ -542,10 +556,40 @@ void janitor_setup(void)
 	safe_evtimer_add(&full_maint_ev, &full_maint_period);
 }
 
+/* clients routed to replica, whose home pool goes away */
+static void close_routed_clients(PgPool *home, const char *reason)
+{
+	List *item, *citem, *tmp;
+	PgPool *pool;
+	PgSocket *client;
+
+	/* only pools of databases with replica have such clients */
+	if (!home->has_routed)
+		return;
+
+	statlist_for_each(item, &pool_list) {
+		pool = container_of(item, PgPool, head);
+		if (pool == home)
+			continue;
+		statlist_for_each_safe(citem, &pool->active_client_list, tmp) {
+			client = container_of(citem, PgSocket, head);
+			if (client->home_pool == home)
+				disconnect_client(client, true, reason);
+		}
+		statlist_for_each_safe(citem, &pool->waiting_client_list, tmp) {
+			client = container_of(citem, PgSocket, head);
+			if (client->home_pool == home)
+				disconnect_client(client, true, reason);
+		}
+	}
+}
+
 static void kill_pool(PgPool *pool)
 {
 	const char *reason = "database removed";
 
+	close_routed_clients(pool, reason);
+
 	close_client_list(&pool->active_client_list, reason);
 	close_client_list(&pool->waiting_client_list, reason);
 	close_client_list(&pool->cancel_req_list, reason);
@@ -556,6 +600,11 @@ static void kill_pool(PgPool *pool)
 	close_server_list(&pool->tested_server_list, reason);
 	close_server_list(&pool->new_server_list, reason);
 
+	stop_wait_timer(pool);
+	cache_purge_pool(pool);
+	metrics_forget_pool(pool);
+	admin_stream_forget_pool(pool);
+
 	list_del(&pool->map_head);
 	statlist_remove(&pool->head, &pool_list);
 	obj_free(pool_cache, pool);
@@ -565,6 +614,7 @@ static void kill_database(PgDatabase *db)
 {
 	PgPool *pool;
 	List *item, *tmp;
+	int i;
 
 	log_warning("dropping database '%s' as it does not exist anymore or inactive auto-database", db->name);
 
@@ -573,14 +623,18 @@ static void kill_database(PgDatabase *db)
 		if (pool->db == db)
 			kill_pool(pool);
 	}
+	auth_query_purge_db(db);
 	if (db->forced_user)
 		obj_free(user_cache, db->forced_user);
+	for (i = 0; i < db->host_count; i++)
+		host_unref(db->hosts[i]);
 	if (db->connect_query)
 		free((void *)db->connect_query);
 	if (db->inactive_time)
 		statlist_remove(&db->head, &autodatabase_idle_list);
 	else
 		statlist_remove(&db->head, &database_list);
+	tree_remove(&database_tree, (long)db->name);
 	obj_free(db_cache, db);
 }
 
@@ -595,6 +649,7 @@ void config_postprocess(void)
 		db = container_of(item, PgDatabase, head);
 		if (db->db_dead) {
 			kill_database(db);
+			g_reload_removed++;
 			continue;
 		}
 		if (db->max_client_conn < -1)
@@ -22,10 +22,6 @@
 
 #include "bouncer.h"
 
-#ifdef HAVE_NETDB_H
-#include <netdb.h>
-#endif
-
 /*
  * ConnString parsing
  */
@@ -177,18 +173,101 @@ static int parse_unlimited_int(const char *val)
 	return atoi(val);
 }
 
+/*
+ * Parse ip-address.  Host names are left as INADDR_NONE,
+ * they are resolved asynchronously later.
+ */
+static bool parse_host_addr(const char *dbname, const char *host, in_addr_t *addr_p)
+{
+	*addr_p = INADDR_NONE;
+	if (host[0] < '0' || host[0] > '9')
+		return true;
+
+	*addr_p = inet_addr(host);
+	if (*addr_p == INADDR_NONE) {
+		log_error("skipping database %s because"
+				" of bad host: %s", dbname, host);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Parse comma-separated host list, each host may have
+ * its own port as host:port.  Modifies the string.
+ * Returns number of hosts or -1 on error.
+ */
+static int parse_host_list(const char *dbname, char *hosts, int def_port, int max,
+			   char **names, int *ports, in_addr_t *addrs)
+{
+	char *p, *next, *sep;
+	int n = 0;
+
+	for (p = hosts; p; p = next) {
+		next = strchr(p, ',');
+		if (next)
+			*next++ = 0;
+		if (n >= max) {
+			log_error("skipping database %s because"
+				  " of too many hosts", dbname);
+			return -1;
+		}
+		ports[n] = def_port;
+		sep = strchr(p, ':');
+		if (sep) {
+			*sep++ = 0;
+			ports[n] = atoi(sep);
+			if (ports[n] <= 0 || ports[n] > 65535) {
+				log_error("skipping database %s because"
+					  " of bad port: %s", dbname, sep);
+				return -1;
+			}
+		}
+		if (!*p || *p == '/') {
+			log_error("skipping database %s because"
+				  " of bad host in list: '%s'", dbname, p);
+			return -1;
+		}
+		if (!parse_host_addr(dbname, p, &addrs[n]))
+			return -1;
+		names[n++] = p;
+	}
+	return n;
+}
+
+/* same hosts in any order, order only affects where balancing starts */
+static bool same_hosts(PgHost **h1, PgHost **h2, int count)
+{
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < count; j++) {
+			if (h1[i] == h2[j])
+				break;
+		}
+		if (j == count)
+			return false;
+	}
+	return true;
+}
+
 /* fill PgDatabase from connstr */
 void parse_database(char *name, char *connstr)
 {
 	char *p, *key, *val;
 	PktBuf buf;
+	uint8_t startup_params[sizeof(((PgDatabase *)0)->startup_params)];
+	int dbname_pos;
 	PgDatabase *db;
 	int max_client_conn = -2;
 	int pool_size = -2;
 	int res_pool_size = -1;
+	int budget_weight = 1;
+	char *replica = "";
 
 	char *dbname = name;
 	char *host = NULL;
+	char *standby_host = NULL;
 	char *port = "5432";
 	char *username = NULL;
 	char *password = "";
@@ -198,7 +277,11 @@ void parse_database(char *name, char *connstr)
 	char *connect_query = NULL;
 	char *unix_dir = "";
 
-	in_addr_t v_addr = INADDR_NONE;
+	char *host_names[MAX_DB_HOSTS];
+	int host_ports[MAX_DB_HOSTS];
+	in_addr_t host_addrs[MAX_DB_HOSTS];
+	PgHost *hosts[MAX_DB_HOSTS];
+	int i, host_count = 0, primary_count;
 	int v_port;
 
 	if (strcmp(name, "*") == 0) {
@@ -219,6 +302,8 @@ void parse_database(char *name, char *connstr)
 			dbname = val;
 		else if (strcmp("host", key) == 0)
 			host = val;
+		else if (strcmp("standby_host", key) == 0)
+			standby_host = val;
 		else if (strcmp("port", key) == 0)
 			port = val;
 		else if (strcmp("user", key) == 0)
@@ -239,6 +324,10 @@ void parse_database(char *name, char *connstr)
 			res_pool_size = atoi(val);
 		else if (strcmp("connect_query", key) == 0)
 			connect_query = val;
+		else if (strcmp("budget_weight", key) == 0)
+			budget_weight = atoi(val);
+		else if (strcmp("replica", key) == 0)
+			replica = val;
 		else {
 			log_error("skipping database %s because"
 				  " of unknown parameter in connstring: %s", name, key);
@@ -246,6 +335,14 @@ void parse_database(char *name, char *connstr)
 		}
 	}
 
+	/* port= */
+	v_port = atoi(port);
+	if (v_port == 0) {
+		log_error("skipping database %s because"
+			  " of bad port: %s", name, port);
+		return;
+	}
+
 	/* host= */
 	if (!host) {
 		/* default unix socket dir */
@@ -258,37 +355,34 @@ void parse_database(char *name, char *connstr)
 		/* custom unix socket dir */
 		unix_dir = host;
 		host = NULL;
-	} else if (host[0] >= '0' && host[0] <= '9') {
-		/* ip-address */
-		v_addr = inet_addr(host);
-		if (v_addr == INADDR_NONE) {
-			log_error("skipping database %s because"
-					" of bad host: %s", name, host);
-			return;
-		}
 	} else {
-		/* resolve host by name */
-		struct hostent *h = gethostbyname(host);
-		if (h == NULL || h->h_addr_list[0] == NULL) {
-			log_error("%s: resolving host=%s failed: %s",
-				  name, host, hstrerror(h_errno));
+		host_count = parse_host_list(name, host, v_port, MAX_DB_HOSTS,
+					     host_names, host_ports, host_addrs);
+		if (host_count < 0)
 			return;
-		}
-		if (h->h_addrtype != AF_INET || h->h_length != 4) {
-			log_error("%s: host=%s has unknown addr type",
-				  name, host);
-			return;
-		}
+	}
 
-		/* result should be already in correct endianess */
-		memcpy(&v_addr, h->h_addr_list[0], 4);
+	/* standby_host= */
+	primary_count = host_count;
+	if (standby_host && !host) {
+		log_error("skipping database %s because"
+			  " standby_host needs host", name);
+		return;
+	} else if (standby_host) {
+		i = parse_host_list(name, standby_host, v_port,
+				    MAX_DB_HOSTS - host_count,
+				    host_names + host_count,
+				    host_ports + host_count,
+				    host_addrs + host_count);
+		if (i < 0)
+			return;
+		host_count += i;
 	}
 
-	/* port= */
-	v_port = atoi(port);
-	if (v_port == 0) {
+	/* budget_weight= */
+	if (budget_weight < 1) {
 		log_error("skipping database %s because"
-			  " of bad port: %s", name, port);
+			  " of bad budget_weight: %d", name, budget_weight);
 		return;
 	}
 
@@ -304,23 +398,64 @@ void parse_database(char *name, char *connstr)
 	db->db_auto = 0;
 	db->inactive_time = 0;
 
-	/* if updating old db, check if anything changed */
+	for (i = 0; i < host_count; i++) {
+		hosts[i] = host_get(host_names[i], host_ports[i], host_addrs[i]);
+		if (!hosts[i]) {
+			log_error("cannot create host, no memory?");
+			while (--i >= 0)
+				host_unref(hosts[i]);
+			return;
+		}
+	}
+
+	/* build startup packet first, so it can be compared with old one */
+	pktbuf_static(&buf, startup_params, sizeof(startup_params));
+
+	pktbuf_put_string(&buf, "database");
+	dbname_pos = pktbuf_written(&buf);
+	pktbuf_put_string(&buf, dbname);
+
+	if (client_encoding) {
+		pktbuf_put_string(&buf, "client_encoding");
+		pktbuf_put_string(&buf, client_encoding);
+	}
+
+	if (datestyle) {
+		pktbuf_put_string(&buf, "datestyle");
+		pktbuf_put_string(&buf, datestyle);
+	}
+
+	if (timezone) {
+		pktbuf_put_string(&buf, "timezone");
+		pktbuf_put_string(&buf, timezone);
+	}
+
+	/*
+	 * If updating old db, check if anything changed that affects
+	 * server connections.  Compare parsed values, so reformatting
+	 * connstr or changing pool settings does not drop servers.
+	 */
 	if (db->dbname) {
 		bool changed = false;
-		if (strcmp(db->dbname, dbname) != 0)
+		if (pktbuf_written(&buf) != (int)db->startup_params_len)
 			changed = true;
-		else if (host && db->addr.is_unix)
+		else if (memcmp(startup_params, db->startup_params, db->startup_params_len) != 0)
 			changed = true;
-		else if (!host && !db->addr.is_unix)
+		else if (primary_count != db->primary_count || host_count != db->host_count)
 			changed = true;
-		else if (host && v_addr != db->addr.ip_addr.s_addr)
+		else if (!same_hosts(hosts, db->hosts, primary_count))
 			changed = true;
-		else if (v_port != db->addr.port)
+		else if (!same_hosts(hosts + primary_count, db->hosts + primary_count,
+				     host_count - primary_count))
+			changed = true;
+		else if (!host && v_port != db->addr.port)
 			changed = true;
 		else if (username && !db->forced_user)
 			changed = true;
 		else if (username && strcmp(username, db->forced_user->name) != 0)
 			changed = true;
+		else if (username && strcmp(password, db->forced_user->passwd) != 0)
+			changed = true;
 		else if (!username && db->forced_user)
 			changed = true;
 		else if (strcmp(db->unix_socket_dir, unix_dir) != 0)
@@ -330,8 +465,11 @@ void parse_database(char *name, char *connstr)
 			 || (connect_query && strcmp(connect_query, db->connect_query) != 0))
 			changed = true;
 
-		if (changed)
+		if (changed) {
+			log_info("database %s changed, reconnecting servers", name);
+			g_reload_changed++;
 			tag_database_dirty(db);
+		}
 	}
 
 	/* if max_client_conn < -1 it will be set later */
@@ -339,39 +477,30 @@ void parse_database(char *name, char *connstr)
 	/* if pool_size < -1 it will be set later */
 	db->pool_size = pool_size;
 	db->res_pool_size = res_pool_size;
+	db->budget_weight = budget_weight;
+	safe_strcpy(db->replica_name, replica, sizeof(db->replica_name));
 	db->addr.port = v_port;
-	db->addr.ip_addr.s_addr = v_addr;
+	db->addr.ip_addr.s_addr = INADDR_NONE;
 	db->addr.is_unix = host ? 0 : 1;
 	safe_strcpy(db->unix_socket_dir, unix_dir, sizeof(db->unix_socket_dir));
 
-	if (host)
-		log_debug("%s: host=%s/%s", name, host, inet_ntoa(db->addr.ip_addr));
+	/* replace host list, new refs are taken above */
+	for (i = 0; i < db->host_count; i++)
+		host_unref(db->hosts[i]);
+	for (i = 0; i < host_count; i++) {
+		db->hosts[i] = hosts[i];
+		log_debug("%s: host=%s:%d/%s", name, hosts[i]->name,
+			  hosts[i]->addr.port, inet_ntoa(hosts[i]->addr.ip_addr));
+	}
+	db->host_count = host_count;
+	db->primary_count = primary_count;
 
 	/* assign connect_query */
 	set_connect_query(db, connect_query);
 
-	pktbuf_static(&buf, db->startup_params, sizeof(db->startup_params));
-
-	pktbuf_put_string(&buf, "database");
-	db->dbname = (char *)db->startup_params + pktbuf_written(&buf);
-	pktbuf_put_string(&buf, dbname);
-
-	if (client_encoding) {
-		pktbuf_put_string(&buf, "client_encoding");
-		pktbuf_put_string(&buf, client_encoding);
-	}
-
-	if (datestyle) {
-		pktbuf_put_string(&buf, "datestyle");
-		pktbuf_put_string(&buf, datestyle);
-	}
-
-	if (timezone) {
-		pktbuf_put_string(&buf, "timezone");
-		pktbuf_put_string(&buf, timezone);
-	}
-
 	db->startup_params_len = pktbuf_written(&buf);
+	memcpy(db->startup_params, startup_params, db->startup_params_len);
+	db->dbname = (char *)db->startup_params + dbname_pos;
 
 	/* if user is forces, create fake object for it */
 	if (username != NULL) {
@@ -399,31 +528,49 @@ loop:
 	return p;
 }
 
-/* string is unquoted while copying */
-static void copy_quoted(char *dst, const char *src, int len)
+/* drop escapes, unquoted value is never longer so it is done in place */
+static void unquote_inplace(char *str)
 {
-	char *end = dst + len - 1;
-	while (*src && dst < end) {
-		if (*src != '\\')
-			*dst++ = *src++;
-		else
-			src++;
+	char *dst = str;
+	for (; *str; str++) {
+		if (*str != '\\')
+			*dst++ = *str;
 	}
 	*dst = 0;
 }
 
-static void unquote_add_user(const char *username, const char *password)
+/* read whole file, safe to call outside main thread */
+static char *read_auth_file(const char *fn, const char **err_p)
 {
-	char real_user[MAX_USERNAME];
-	char real_passwd[MAX_PASSWORD];
-	PgUser *user;
-
-	copy_quoted(real_user, username, sizeof(real_user));
-	copy_quoted(real_passwd, password, sizeof(real_passwd));
+	struct stat st;
+	char *buf;
+	int fd, res;
 
-	user = add_user(real_user, real_passwd);
-	if (!user)
-		log_warning("cannot create user, no memory");
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		*err_p = strerror(errno);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		*err_p = strerror(errno);
+		close(fd);
+		return NULL;
+	}
+	buf = malloc(st.st_size + 1);
+	if (!buf) {
+		*err_p = "no mem";
+		close(fd);
+		return NULL;
+	}
+	res = safe_read(fd, buf, st.st_size);
+	close(fd);
+	if (res < 0) {
+		*err_p = strerror(errno);
+		free(buf);
+		return NULL;
+	}
+	buf[res] = 0;
+	return buf;
 }
 
 static bool auth_loaded(const char *fn)
@@ -452,40 +599,63 @@ static bool auth_loaded(const char *fn)
 	return false;
 }
 
+/*
+ * Periodic check for auth_file changes, for systems without
+ * file change notification.  Parsing happens in background.
+ */
 bool loader_users_check(void)
 {
+	if (authwatch_active())
+		return true;
+
 	if (auth_loaded(cf_auth_file))
 		return true;
 
-	return load_auth_file(cf_auth_file);
+	auth_reload_async();
+	return true;
 }
 
-static void disable_users(void)
+static int cmp_auth_entry(const void *a, const void *b)
 {
-	PgUser *user;
-	List *item;
-
-	statlist_for_each(item, &user_list) {
-		user = container_of(item, PgUser, head);
-		user->passwd[0] = 0;
-	}
+	const AuthEntry *e1 = a, *e2 = b;
+	int res = strcmp(e1->name, e2->name);
+	if (res == 0)
+		res = e1->line - e2->line;
+	return res;
 }
 
-/* load list of users from pg_auth/pg_psw file */
-bool load_auth_file(const char *fn)
+/*
+ * Parse pg_auth/pg_psw style file into sorted list.
+ *
+ * Does not touch any global state, so it can run in separate
+ * thread.  Problems are reported in ->error, entries before
+ * the broken line are still returned.
+ */
+AuthList *parse_auth_file(const char *fn)
 {
-	char *user, *password, *buf, *p;
-
-	buf = load_file(fn);
-	if (buf == NULL) {
-		/* reset file info */
-		auth_loaded(NULL);
-		return false;
+	char *user, *password, *p;
+	AuthList *lst;
+	AuthEntry *e;
+	int alloc = 1024;
+	void *tmp;
+
+	lst = calloc(1, sizeof(*lst));
+	if (!lst)
+		return NULL;
+	lst->list = malloc(alloc * sizeof(AuthEntry));
+	if (!lst->list) {
+		free(lst);
+		return NULL;
+	}
+	lst->buf = read_auth_file(fn, &lst->error);
+	if (!lst->buf)
+		return lst;
+	if (strncmp(lst->buf, AUTHDB_MAGIC, 8) == 0) {
+		lst->compiled = 1;
+		return lst;
 	}
 
-	disable_users();
-
-	p = buf;
+	p = lst->buf;
 	while (*p) {
 		/* skip whitespace and empty lines */
 		while (*p && isspace(*p)) p++;
@@ -494,17 +664,17 @@ bool load_auth_file(const char *fn)
 
 		/* start of line */
 		if (*p != '"') {
-			log_error("broken auth file");
+			lst->error = "broken auth file";
 			break;
 		}
 		user = ++p;
 		p = find_quote(p);
 		if (*p != '"') {
-			log_error("broken auth file");
+			lst->error = "broken auth file";
 			break;
 		}
 		if (p - user >= MAX_USERNAME) {
-			log_error("username too long");
+			lst->error = "username too long";
 			break;
 		}
 		*p++ = 0; /* tag username end */
@@ -512,32 +682,145 @@ bool load_auth_file(const char *fn)
 		/* get password */
 		p = find_quote(p);
 		if (*p != '"') {
-			log_error("broken auth file");
+			lst->error = "broken auth file";
 			break;
 		}
 		password = ++p;
 		p = find_quote(p);
 		if (*p != '"') {
-			log_error("broken auth file");
+			lst->error = "broken auth file";
 			break;
 		}
 		if (p - password >= MAX_PASSWORD) {
-			log_error("too long password");
+			lst->error = "too long password";
 			break;
 		}
 		*p++ = 0; /* tag password end */
 
-		/* send them away */
-		unquote_add_user(user, password);
+		if (lst->count >= alloc) {
+			tmp = realloc(lst->list, alloc * 2 * sizeof(AuthEntry));
+			if (!tmp) {
+				lst->error = "no mem";
+				break;
+			}
+			lst->list = tmp;
+			alloc *= 2;
+		}
+		e = &lst->list[lst->count];
+		unquote_inplace(user);
+		unquote_inplace(password);
+		e->name = user;
+		e->passwd = password;
+		e->line = lst->count++;
 
 		/* skip rest of the line */
 		while (*p && *p != '\n') p++;
 	}
-	free(buf);
 
+	qsort(lst->list, lst->count, sizeof(AuthEntry), cmp_auth_entry);
+	return lst;
+}
+
+void free_auth_list(AuthList *lst)
+{
+	if (!lst)
+		return;
+	free(lst->buf);
+	free(lst->list);
+	free(lst);
+}
+
+/*
+ * Merge sorted list into user_list, which is sorted too.  Only changed
+ * users are touched, users missing from file are disabled.  PgUser
+ * objects are never freed as pools point to them.
+ */
+bool apply_auth_list(const char *fn, AuthList *lst)
+{
+	List *head = &user_list.head;
+	List *item = head->next;
+	AuthEntry *e, *end;
+	PgUser *user = NULL;
+	int cmp = 1, added = 0, changed = 0, disabled = 0;
+
+	if (!lst) {
+		log_error("%s: no mem", fn);
+		return false;
+	}
+	if (!lst->buf) {
+		log_error("%s: %s", fn, lst->error);
+		/* reset file info */
+		auth_loaded(NULL);
+		free_auth_list(lst);
+		return false;
+	}
+	if (lst->compiled) {
+		/* file was replaced with compiled one meanwhile */
+		free_auth_list(lst);
+		return authdb_load(fn);
+	}
+	if (lst->error)
+		log_error("%s: %s", fn, lst->error);
+
+	/* switching from compiled file */
+	authdb_close();
+
+	end = lst->list + lst->count;
+	for (e = lst->list; e < end; e++) {
+		/* same user repeated, last one wins */
+		if (e + 1 < end && strcmp(e->name, e[1].name) == 0)
+			continue;
+
+		for (; item != head; item = item->next) {
+			user = container_of(item, PgUser, head);
+			cmp = strcmp(user->name, e->name);
+			if (cmp >= 0)
+				break;
+			if (user->passwd[0] && !user->from_query) {
+				user->passwd[0] = 0;
+				disabled++;
+			}
+		}
+
+		if (item != head && cmp == 0) {
+			user->from_query = 0;
+			if (strcmp(user->passwd, e->passwd) != 0) {
+				safe_strcpy(user->passwd, e->passwd, sizeof(user->passwd));
+				changed++;
+			}
+			item = item->next;
+		} else {
+			user = insert_user(e->name, e->passwd, item);
+			if (!user) {
+				log_warning("cannot create user, no memory");
+				break;
+			}
+			added++;
+		}
+	}
+	for (; item != head; item = item->next) {
+		user = container_of(item, PgUser, head);
+		if (user->passwd[0] && !user->from_query) {
+			user->passwd[0] = 0;
+			disabled++;
+		}
+	}
+
+	if (added || changed || disabled)
+		log_info("%s: %d users, %d added, %d changed, %d disabled",
+			 fn, lst->count, added, changed, disabled);
+	free_auth_list(lst);
 	return true;
 }
 
+/* load list of users from pg_auth/pg_psw file or compiled file */
+bool load_auth_file(const char *fn)
+{
+	if (authdb_is_compiled(fn))
+		return authdb_load(fn);
+	return apply_auth_list(fn, parse_auth_file(fn));
+}
+
 /*
  * Config parameter handling.
  */
@@ -578,6 +861,7 @@ const char *cf_get_int(ConfElem *elem)
 	return numbuf;
 }
 
+/* seconds, fractions are allowed */
 bool cf_set_time(ConfElem *elem, const char *val, PgSocket *console)
 {
 	usec_t *time_p = elem->dst;
@@ -585,7 +869,7 @@ bool cf_set_time(ConfElem *elem, const char *val, PgSocket *console)
 		admin_error(console, "bad value: %s", val);
 		return false;
 	}
-	*time_p = USEC * (usec_t)atoi(val);
+	*time_p = (usec_t)(strtod(val, NULL) * USEC + 0.5);
 	return true;
 }
 
@@ -593,9 +877,15 @@ const char *cf_get_time(ConfElem *elem)
 {
 	static char numbuf[32];
 	usec_t val;
+	int len;
 
 	val = *(usec_t *)elem->dst;
-	sprintf(numbuf, "%d", (int)(val / USEC));
+	len = sprintf(numbuf, "%d", (int)(val / USEC));
+	if (val % USEC) {
+		len += sprintf(numbuf + len, ".%06d", (int)(val % USEC));
+		while (numbuf[len - 1] == '0')
+			numbuf[--len] = 0;
+	}
 	return numbuf;
 }
 
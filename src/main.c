@@ -30,6 +30,10 @@ static const char *get_mode(ConfElem *elem);
 static bool set_auth(ConfElem *elem, const char *val, PgSocket *console);
 static const char *get_auth(ConfElem *elem);
 static bool set_defer_accept(ConfElem *elem, const char *val, PgSocket *console);
+static bool set_local_queries(ConfElem *elem, const char *val, PgSocket *console);
+static bool set_cache_queries(ConfElem *elem, const char *val, PgSocket *console);
+static bool set_trace_size(ConfElem *elem, const char *val, PgSocket *console);
+static bool set_query_wait_timeout(ConfElem *elem, const char *val, PgSocket *console);
 
 static const char *usage_str =
 "Usage: %s [OPTION]... config.ini\n"
@@ -39,11 +43,17 @@ static const char *usage_str =
 "  -v            Increase verbosity\n"
 "  -u <username> Assume identity of <username>\n"
 "  -V            Show version\n"
-"  -h            Show this help screen and exit\n";
+"  -h            Show this help screen and exit\n"
+"\n"
+"       %s --compile-auth auth_file compiled_file\n"
+"  Write auth_file in compiled form that is searched without loading\n"
+"\n"
+"       %s --shm-stats stats_shm_file\n"
+"  Print pool stats published by running pgbouncer\n";
 
 static void usage(int err, char *exe)
 {
-	printf(usage_str, basename(exe));
+	printf(usage_str, basename(exe), basename(exe), basename(exe));
 	exit(err);
 }
 
@@ -64,6 +74,8 @@ char *cf_config_file = "";
 
 char *cf_listen_addr = NULL;
 int cf_listen_port = 6432;
+char *cf_metrics_addr = "127.0.0.1";
+int cf_metrics_port = 0;
 #ifndef WIN32
 char *cf_unix_socket_dir = "/tmp";
 #else
@@ -75,6 +87,7 @@ int cf_pool_mode = POOL_SESSION;
 /* sbuf config */
 int cf_sbuf_len = 2048;
 int cf_sbuf_loopcnt = 5;
+int cf_pool_loop_budget = 0;
 int cf_tcp_socket_buffer = 0;
 #if defined(TCP_DEFER_ACCEPT) || defined(SO_ACCEPTFILTER)
 int cf_tcp_defer_accept = 1;
@@ -88,6 +101,11 @@ int cf_tcp_keepintvl = 0;
 
 int cf_auth_type = AUTH_MD5;
 char *cf_auth_file = "unconfigured_file";
+char *cf_auth_user = "";
+char *cf_auth_query = "SELECT usename, passwd FROM pg_shadow WHERE usename=$1";
+usec_t cf_auth_cache_ttl = 60*USEC;
+usec_t cf_auth_cache_negative_ttl = 5*USEC;
+int cf_auth_cache_size = 10000;
 
 int cf_max_client_conn = 100;
 int cf_default_pool_max_client_conn = -1;
@@ -110,24 +128,45 @@ usec_t cf_server_lifetime = 60*60*USEC;
 usec_t cf_server_idle_timeout = 10*60*USEC;
 usec_t cf_server_connect_timeout = 15*USEC;
 usec_t cf_server_login_retry = 15*USEC;
+usec_t cf_dns_max_ttl = 15*USEC;
 usec_t cf_query_timeout = 0*USEC;
+usec_t cf_query_wait_timeout = 0*USEC;
+int cf_query_wait_shed = 0;
 usec_t cf_client_idle_timeout = 0*USEC;
 usec_t cf_client_login_timeout = 60*USEC;
 usec_t cf_suspend_timeout = 10*USEC;
 
 usec_t g_suspend_start = 0;
 
+usec_t g_reload_time = 0;
+usec_t g_reload_duration = 0;
+int g_reload_changed = 0;
+int g_reload_removed = 0;
+
 char *cf_logfile = "";
 char *cf_pidfile = "";
 char *cf_jobname = "pgbouncer";
 
 char *cf_admin_users = "";
 char *cf_stats_users = "";
+char *cf_priority_users = "";
+char *cf_batch_users = "";
+char *cf_local_queries = "";
+char *cf_cache_queries = "";
+usec_t cf_cache_ttl = 5*USEC;
+int cf_cache_max_size = 1024*1024;
 int cf_stats_period = 60;
+char *cf_stats_shm_file = "";
+int cf_trace_size = 0;
+char *cf_trace_file = "";
 
 int cf_log_connections = 1;
 int cf_log_disconnections = 1;
 int cf_log_pooler_errors = 1;
+usec_t cf_log_slow_wait = 0;
+usec_t cf_log_slow_query = 0;
+usec_t cf_log_slow_xact = 0;
+int cf_log_slow_limit = 10;
 
 /*
  * config file description
@@ -142,11 +181,18 @@ ConfElem bouncer_params[] = {
 {"pidfile",		false, CF_STR, &cf_pidfile},
 {"listen_addr",		false, CF_STR, &cf_listen_addr},
 {"listen_port",		false, CF_INT, &cf_listen_port},
+{"metrics_addr",	false, CF_STR, &cf_metrics_addr},
+{"metrics_port",	false, CF_INT, &cf_metrics_port},
 #ifndef WIN32
 {"unix_socket_dir",	false, CF_STR, &cf_unix_socket_dir},
 #endif
 {"auth_type",		true, {get_auth, set_auth}},
 {"auth_file",		true, CF_STR, &cf_auth_file},
+{"auth_user",		true, CF_STR, &cf_auth_user},
+{"auth_query",		true, CF_STR, &cf_auth_query},
+{"auth_cache_ttl",	true, CF_TIME, &cf_auth_cache_ttl},
+{"auth_cache_negative_ttl", true, CF_TIME, &cf_auth_cache_negative_ttl},
+{"auth_cache_size",	true, CF_INT, &cf_auth_cache_size},
 {"pool_mode",		true, {get_mode, set_mode}},
 {"max_client_conn",	true, {cf_get_int, cf_set_unlimited_int}, &cf_max_client_conn},
 {"default_pool_max_client_conn", true, {cf_get_int, cf_set_unlimited_int}, &cf_default_pool_max_client_conn},
@@ -165,18 +211,28 @@ ConfElem bouncer_params[] = {
 {"server_check_query",	true, CF_STR, &cf_server_check_query},
 {"server_check_delay",	true, CF_TIME, &cf_server_check_delay},
 {"query_timeout",	true, CF_TIME, &cf_query_timeout},
+{"query_wait_timeout",	true, {cf_get_time, set_query_wait_timeout}, &cf_query_wait_timeout},
+{"query_wait_shed",	true, CF_INT, &cf_query_wait_shed},
 {"client_idle_timeout",	true, CF_TIME, &cf_client_idle_timeout},
 {"client_login_timeout",true, CF_TIME, &cf_client_login_timeout},
 {"server_lifetime",	true, CF_TIME, &cf_server_lifetime},
 {"server_idle_timeout",	true, CF_TIME, &cf_server_idle_timeout},
 {"server_connect_timeout",true, CF_TIME, &cf_server_connect_timeout},
 {"server_login_retry",	true, CF_TIME, &cf_server_login_retry},
+{"dns_max_ttl",		true, CF_TIME, &cf_dns_max_ttl},
 {"server_round_robin",	true, CF_INT, &cf_server_round_robin},
+{"priority_users",	true, CF_STR, &cf_priority_users},
+{"batch_users",		true, CF_STR, &cf_batch_users},
+{"local_queries",	true, {cf_get_str, set_local_queries}, &cf_local_queries},
+{"cache_queries",	true, {cf_get_str, set_cache_queries}, &cf_cache_queries},
+{"cache_ttl",		true, CF_TIME, &cf_cache_ttl},
+{"cache_max_size",	true, CF_INT, &cf_cache_max_size},
 {"suspend_timeout",	true, CF_TIME, &cf_suspend_timeout},
 {"ignore_startup_parameters", true, CF_STR, &cf_ignore_startup_params},
 
 {"pkt_buf",		false, CF_INT, &cf_sbuf_len},
 {"sbuf_loopcnt",	true, CF_INT, &cf_sbuf_loopcnt},
+{"pool_loop_budget",	true, CF_INT, &cf_pool_loop_budget},
 {"tcp_defer_accept",	true, {cf_get_int, set_defer_accept}, &cf_tcp_defer_accept},
 {"tcp_socket_buffer",	true, CF_INT, &cf_tcp_socket_buffer},
 {"tcp_keepalive",	true, CF_INT, &cf_tcp_keepalive},
@@ -187,9 +243,16 @@ ConfElem bouncer_params[] = {
 {"admin_users",		true, CF_STR, &cf_admin_users},
 {"stats_users",		true, CF_STR, &cf_stats_users},
 {"stats_period",	true, CF_INT, &cf_stats_period},
+{"stats_shm_file",	true, CF_STR, &cf_stats_shm_file},
+{"trace_size",		true, {cf_get_int, set_trace_size}, &cf_trace_size},
+{"trace_file",		true, CF_STR, &cf_trace_file},
 {"log_connections",	true, CF_INT, &cf_log_connections},
 {"log_disconnections",	true, CF_INT, &cf_log_disconnections},
 {"log_pooler_errors",	true, CF_INT, &cf_log_pooler_errors},
+{"log_slow_wait",	true, CF_TIME, &cf_log_slow_wait},
+{"log_slow_query",	true, CF_TIME, &cf_log_slow_query},
+{"log_slow_xact",	true, CF_TIME, &cf_log_slow_xact},
+{"log_slow_limit",	true, CF_INT, &cf_log_slow_limit},
 {NULL},
 };
 
@@ -271,6 +334,87 @@ static bool set_defer_accept(ConfElem *elem, const char *val, PgSocket *console)
 	return true;
 }
 
+static bool set_trace_size(ConfElem *elem, const char *val, PgSocket *console)
+{
+	if (!cf_set_int(elem, val, console))
+		return false;
+	trace_setup();
+	return true;
+}
+
+static bool set_query_wait_timeout(ConfElem *elem, const char *val, PgSocket *console)
+{
+	if (!cf_set_time(elem, val, console))
+		return false;
+	reset_wait_timers();
+	return true;
+}
+
+/* local_queries can contain only SELECT <int> */
+static bool is_select_int(const char *q)
+{
+	const char *num = q + 7;
+
+	if (strlen(q) >= MAX_LOCAL_QUERY || strncmp(q, "select ", 7) != 0)
+		return false;
+	if (*num == '-')
+		num++;
+	return *num && strlen(num) <= 9 && strspn(num, "0123456789") == strlen(num);
+}
+
+/*
+ * Query lists are ';'-separated and stored normalized for matching.
+ */
+static bool set_query_list(ConfElem *elem, const char *val, PgSocket *console, bool local)
+{
+	char q[MAX_CACHE_QUERY];
+	const char *p, *end, *next;
+	char *list, *dst;
+	int len;
+	bool ok;
+
+	list = malloc(strlen(val) + 1);
+	if (!list)
+		return false;
+	dst = list;
+	for (p = val; *p; p = next) {
+		end = strchr(p, ';');
+		if (!end)
+			end = p + strlen(p);
+		next = *end ? end + 1 : end;
+		len = normalize_query(q, sizeof(q), p, end - p);
+		if (len == 0)
+			continue;
+		if (len < 0 || (local && !is_select_int(q))) {
+			if (local)
+				admin_error(console, "local_queries supports only SELECT <int>: %.*s",
+					    (int)(end - p), p);
+			else
+				admin_error(console, "query too long: %.*s", (int)(end - p), p);
+			free(list);
+			return false;
+		}
+		if (dst > list)
+			*dst++ = ';';
+		strcpy(dst, q);
+		dst += len;
+	}
+	*dst = 0;
+	ok = cf_set_str(elem, list, console);
+	free(list);
+	return ok;
+}
+
+static bool set_local_queries(ConfElem *elem, const char *val, PgSocket *console)
+{
+	return set_query_list(elem, val, console, true);
+}
+
+static bool set_cache_queries(ConfElem *elem, const char *val, PgSocket *console)
+{
+	return set_query_list(elem, val, console, false);
+}
+
 static void set_dbs_dead(bool flag)
 {
 	List *item;
@@ -287,19 +431,42 @@ static void set_dbs_dead(bool flag)
 /* config loading, tries to be tolerant to errors */
 void load_config(bool reload)
 {
+	usec_t start = get_time_usec();
 	bool ok;
 
+	g_reload_changed = 0;
+	g_reload_removed = 0;
+
 	set_dbs_dead(true);
 
 	/* actual loading */
 	ok = iniparser(cf_config_file, bouncer_config, reload);
 	if (ok) {
-		/* load users if needed */
-		if (cf_auth_type >= AUTH_TRUST)
-			load_auth_file(cf_auth_file);
+		/* load users if needed, on reload in background */
+		if (cf_auth_type >= AUTH_TRUST) {
+			if (reload)
+				auth_reload_async();
+			else
+				load_auth_file(cf_auth_file);
+		}
+		if (reload)
+			authwatch_update();
 
 		/* reset pool_size, kill dbs */
 		config_postprocess();
+		reset_wait_timers();
+
+		/* new sockets take tcp options from listening socket */
+		if (reload)
+			pooler_tune_sockets();
+
+		g_reload_time = start;
+		g_reload_duration = get_time_usec() - start;
+		log_info("config %s in %llu us: %d databases, %d changed, %d removed",
+			 reload ? "reloaded" : "loaded",
+			 (unsigned long long)g_reload_duration,
+			 statlist_count(&database_list), g_reload_changed,
+			 g_reload_removed);
 	} else {
 		/* if ini file missing, dont kill anybody */
 		set_dbs_dead(false);
@@ -663,11 +830,24 @@ int main(int argc, char *argv[])
 {
 	int c;
 	bool did_takeover = false;
+	bool compile_auth = false;
+	bool shm_stats = false;
 	char *arg_username = NULL;
+	static const struct option long_options[] = {
+		{"compile-auth", no_argument, NULL, 'C'},
+		{"shm-stats", no_argument, NULL, 'S'},
+		{NULL, 0, NULL, 0}
+	};
 
 	/* parse cmdline */
-	while ((c = getopt(argc, argv, "qvhdVRu:")) != EOF) {
+	while ((c = getopt_long(argc, argv, "qvhdVRu:", long_options, NULL)) != EOF) {
 		switch (c) {
+		case 'C':
+			compile_auth = true;
+			break;
+		case 'S':
+			shm_stats = true;
+			break;
 		case 'R':
 			cf_reboot = 1;
 			break;
@@ -692,6 +872,20 @@ int main(int argc, char *argv[])
 			usage(1, argv[0]);
 		}
 	}
+	if (compile_auth) {
+		if (optind + 2 != argc) {
+			fprintf(stderr, "Need source and destination file.  See pgbouncer -h for usage.\n");
+			exit(1);
+		}
+		return authdb_compile(argv[optind], argv[optind + 1]) ? 0 : 1;
+	}
+	if (shm_stats) {
+		if (optind + 1 != argc) {
+			fprintf(stderr, "Need stats file.  See pgbouncer -h for usage.\n");
+			exit(1);
+		}
+		return shmstats_show(argv[optind]) ? 0 : 1;
+	}
 	if (optind + 1 != argc) {
 		fprintf(stderr, "Need config file.  See pgbouncer -h for usage.\n");
 		exit(1);
@@ -743,11 +937,15 @@ int main(int argc, char *argv[])
 	signal_setup();
 	janitor_setup();
 	stats_setup();
+	dns_setup();
+	cache_setup();
+	authwatch_setup();
 
 	if (did_takeover)
 		takeover_finish();
 	else
 		pooler_setup();
+	metrics_setup();
 
 	write_pidfile();
 
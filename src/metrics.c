@@ -0,0 +1,518 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Metrics in Prometheus text format over plain HTTP.
+ *
+ * Response is rendered into small per-connection buffer, which is
+ * refilled when the previous piece is sent.  Position in response is
+ * kept as (step, metric, pool), so big pool lists do not need big
+ * buffers.  Pools that are dropped meanwhile move cursor forward
+ * via metrics_forget_pool().
+ */
+
+#include "bouncer.h"
+
+/* concurrent scrapes */
+#define MAX_METRICS_CONN	16
+
+/* buffer is refilled when less than that is left */
+#define MAX_METRICS_LINE	512
+
+#define METRICS_BUF		8192
+#define MAX_METRICS_REQ		1024
+
+/* seconds between attempts to get listening socket */
+#define METRICS_RETRY		15
+
+enum MetricsStep {
+	MS_READ,
+	MS_NOT_FOUND,
+	MS_HEADER,
+	MS_GLOBAL,
+	MS_POOLS,
+	MS_CACHES,
+	MS_DONE,
+};
+
+typedef struct MetricsConn {
+	List head;		/* entry in conn_list */
+	int fd;
+	struct event ev;
+	enum MetricsStep step;
+	int metric;		/* current entry in metric table */
+	bool started;		/* HELP and TYPE of metric written */
+	PgPool *pool;		/* next pool to write, NULL at end */
+	int req_len;
+	char req[MAX_METRICS_REQ];
+	int buf_pos;
+	int buf_len;
+	char buf[METRICS_BUF];
+} MetricsConn;
+
+struct GlobalMetric {
+	const char *name;
+	const char *type;
+	const char *help;
+	uint64_t (*get)(void);
+	bool usec;
+};
+
+struct PoolMetric {
+	const char *name;
+	const char *type;
+	const char *help;
+	uint64_t (*get)(PgPool *pool);
+	bool usec;
+};
+
+static int fd_metrics = -1;
+static struct event ev_listen;
+static usec_t next_try;
+
+static LIST(conn_list);
+static int conn_count;
+
+static const struct timeval conn_timeout = { 10, 0 };
+
+/*
+ * Metric tables
+ */
+
+static uint64_t get_databases(void) { return statlist_count(&database_list); }
+static uint64_t get_users(void) { return statlist_count(&user_list); }
+static uint64_t get_pools(void) { return statlist_count(&pool_list); }
+static uint64_t get_clients(void) { return get_active_client_count(); }
+static uint64_t get_servers(void) { return get_active_server_count(); }
+static uint64_t get_reload_time(void) { return g_reload_duration; }
+
+static const struct GlobalMetric global_metrics[] = {
+	{ "pgbouncer_databases", "gauge", "Configured databases", get_databases },
+	{ "pgbouncer_users", "gauge", "Known users", get_users },
+	{ "pgbouncer_pools", "gauge", "Pools", get_pools },
+	{ "pgbouncer_client_connections", "gauge", "Client connections", get_clients },
+	{ "pgbouncer_server_connections", "gauge", "Server connections", get_servers },
+	{ "pgbouncer_last_reload_seconds", "gauge", "Duration of last config load", get_reload_time, true },
+};
+
+static uint64_t get_cl_active(PgPool *p) { return statlist_count(&p->active_client_list); }
+static uint64_t get_cl_waiting(PgPool *p) { return statlist_count(&p->waiting_client_list); }
+static uint64_t get_sv_active(PgPool *p) { return statlist_count(&p->active_server_list); }
+static uint64_t get_sv_idle(PgPool *p) { return statlist_count(&p->idle_server_list); }
+static uint64_t get_sv_used(PgPool *p) { return statlist_count(&p->used_server_list); }
+static uint64_t get_sv_tested(PgPool *p) { return statlist_count(&p->tested_server_list); }
+static uint64_t get_sv_login(PgPool *p) { return statlist_count(&p->new_server_list); }
+static uint64_t get_requests(PgPool *p) { return p->stats.request_count; }
+static uint64_t get_received(PgPool *p) { return p->stats.client_bytes; }
+static uint64_t get_sent(PgPool *p) { return p->stats.server_bytes; }
+static uint64_t get_query_time(PgPool *p) { return p->stats.query_time; }
+static uint64_t get_xacts(PgPool *p) { return p->stats.xact_count; }
+static uint64_t get_queries(PgPool *p) { return p->stats.query_count; }
+static uint64_t get_xact_time(PgPool *p) { return p->stats.xact_time; }
+static uint64_t get_wait_time(PgPool *p) { return p->stats.wait_time; }
+static uint64_t get_cache_hits(PgPool *p) { return p->cache_hits; }
+static uint64_t get_cache_misses(PgPool *p) { return p->cache_misses; }
+
+static const struct PoolMetric pool_metrics[] = {
+	{ "pgbouncer_pool_client_active", "gauge", "Clients linked to server or idle", get_cl_active },
+	{ "pgbouncer_pool_client_waiting", "gauge", "Clients waiting for server", get_cl_waiting },
+	{ "pgbouncer_pool_server_active", "gauge", "Servers linked to client", get_sv_active },
+	{ "pgbouncer_pool_server_idle", "gauge", "Servers ready for use", get_sv_idle },
+	{ "pgbouncer_pool_server_used", "gauge", "Servers waiting for check query", get_sv_used },
+	{ "pgbouncer_pool_server_tested", "gauge", "Servers running reset or check query", get_sv_tested },
+	{ "pgbouncer_pool_server_login", "gauge", "Servers in login phase", get_sv_login },
+	{ "pgbouncer_requests_total", "counter", "Requests pooled", get_requests },
+	{ "pgbouncer_received_bytes_total", "counter", "Bytes received from clients", get_received },
+	{ "pgbouncer_sent_bytes_total", "counter", "Bytes sent by servers", get_sent },
+	{ "pgbouncer_query_time_seconds_total", "counter", "Time spent in queries", get_query_time, true },
+	{ "pgbouncer_xacts_total", "counter", "Transactions finished", get_xacts },
+	{ "pgbouncer_queries_total", "counter", "Queries finished", get_queries },
+	{ "pgbouncer_xact_time_seconds_total", "counter", "Time servers were held by transactions", get_xact_time, true },
+	{ "pgbouncer_wait_time_seconds_total", "counter", "Time clients waited for server", get_wait_time, true },
+	{ "pgbouncer_cache_hits_total", "counter", "Queries answered from result cache", get_cache_hits },
+	{ "pgbouncer_cache_misses_total", "counter", "Cacheable queries sent to server", get_cache_misses },
+};
+
+#define N_GLOBAL (int)(sizeof(global_metrics) / sizeof(global_metrics[0]))
+#define N_POOL (int)(sizeof(pool_metrics) / sizeof(pool_metrics[0]))
+
+/*
+ * Rendering
+ */
+
+static void add_text(MetricsConn *c, const char *fmt, ...) _PRINTF(2, 3);
+static void add_text(MetricsConn *c, const char *fmt, ...)
+{
+	int avail = sizeof(c->buf) - c->buf_len;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(c->buf + c->buf_len, avail, fmt, ap);
+	va_end(ap);
+	if (len > 0 && len < avail)
+		c->buf_len += len;
+}
+
+/* label value with \, " and newline escaped */
+static const char *label(char *dst, int dstlen, const char *src)
+{
+	int i, n = 0;
+
+	for (i = 0; src[i] && n < dstlen - 2; i++) {
+		if (src[i] == '\\' || src[i] == '"' || src[i] == '\n') {
+			dst[n++] = '\\';
+			dst[n++] = src[i] == '\n' ? 'n' : src[i];
+		} else
+			dst[n++] = src[i];
+	}
+	dst[n] = 0;
+	return dst;
+}
+
+static void add_value(MetricsConn *c, uint64_t val, bool usec)
+{
+	if (usec)
+		add_text(c, " %" PRIu64 ".%06u\n", (uint64_t)(val / USEC), (unsigned)(val % USEC));
+	else
+		add_text(c, " %" PRIu64 "\n", val);
+}
+
+static void add_family(MetricsConn *c, const char *name, const char *type, const char *help)
+{
+	add_text(c, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static PgPool *next_pool(PgPool *pool)
+{
+	List *item = pool ? pool->head.next : pool_list.head.next;
+
+	if (item == &pool_list.head)
+		return NULL;
+	return container_of(item, PgPool, head);
+}
+
+static void render_global(MetricsConn *c)
+{
+	const struct GlobalMetric *m = &global_metrics[c->metric];
+
+	add_family(c, m->name, m->type, m->help);
+	add_text(c, "%s", m->name);
+	add_value(c, m->get(), m->usec);
+	if (++c->metric == N_GLOBAL) {
+		c->metric = 0;
+		c->step = MS_POOLS;
+	}
+}
+
+static void render_pool(MetricsConn *c)
+{
+	const struct PoolMetric *m = &pool_metrics[c->metric];
+	char db[MAX_DBNAME * 2], user[MAX_USERNAME * 2];
+
+	if (!c->started) {
+		add_family(c, m->name, m->type, m->help);
+		c->started = true;
+		c->pool = next_pool(NULL);
+	} else if (c->pool) {
+		add_text(c, "%s{database=\"%s\",user=\"%s\"}", m->name,
+			 label(db, sizeof(db), c->pool->db->name),
+			 label(user, sizeof(user), c->pool->user->name));
+		add_value(c, m->get(c->pool), m->usec);
+		c->pool = next_pool(c->pool);
+	} else {
+		c->started = false;
+		if (++c->metric == N_POOL) {
+			c->metric = 0;
+			c->step = MS_CACHES;
+		}
+	}
+}
+
+static void cache_line(void *arg, const char *name, unsigned size, unsigned free, unsigned total)
+{
+	MetricsConn *c = arg;
+
+	switch (c->metric) {
+	case 0:
+		add_text(c, "pgbouncer_objcache_objects{cache=\"%s\"} %u\n", name, total);
+		break;
+	case 1:
+		add_text(c, "pgbouncer_objcache_free_objects{cache=\"%s\"} %u\n", name, free);
+		break;
+	case 2:
+		add_text(c, "pgbouncer_objcache_bytes{cache=\"%s\"} %u\n", name, size * total);
+		break;
+	}
+}
+
+/* object caches are few, one metric fits into buffer at once */
+static void render_caches(MetricsConn *c)
+{
+	static const char *names[] = {
+		"pgbouncer_objcache_objects",
+		"pgbouncer_objcache_free_objects",
+		"pgbouncer_objcache_bytes",
+	};
+	static const char *helps[] = {
+		"Objects allocated",
+		"Objects on free list",
+		"Memory allocated for objects",
+	};
+
+	add_family(c, names[c->metric], "gauge", helps[c->metric]);
+	objcache_stats(cache_line, c);
+	if (++c->metric == 3)
+		c->step = MS_DONE;
+}
+
+/* refill empty buffer with next part of response */
+static void render(MetricsConn *c)
+{
+	static const char not_found[] =
+		"HTTP/1.0 404 Not Found\r\n"
+		"Content-Type: text/plain\r\n"
+		"Connection: close\r\n\r\n"
+		"Only /metrics is available\n";
+	static const char header[] =
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Connection: close\r\n\r\n";
+
+	c->buf_pos = c->buf_len = 0;
+	while (c->buf_len < METRICS_BUF - MAX_METRICS_LINE) {
+		switch (c->step) {
+		case MS_NOT_FOUND:
+			add_text(c, "%s", not_found);
+			c->step = MS_DONE;
+			break;
+		case MS_HEADER:
+			add_text(c, "%s", header);
+			c->step = MS_GLOBAL;
+			break;
+		case MS_GLOBAL:
+			render_global(c);
+			break;
+		case MS_POOLS:
+			render_pool(c);
+			break;
+		case MS_CACHES:
+			if (c->buf_len > 0)
+				return;
+			render_caches(c);
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+/*
+ * Connection handling
+ */
+
+static void close_conn(MetricsConn *c)
+{
+	event_del(&c->ev);
+	safe_close(c->fd);
+	list_del(&c->head);
+	conn_count--;
+	free(c);
+}
+
+static void conn_cb(int fd, short flags, void *arg);
+
+static void wait_conn(MetricsConn *c, short flags)
+{
+	struct timeval tv = conn_timeout;
+
+	event_set(&c->ev, c->fd, flags, conn_cb, c);
+	if (event_add(&c->ev, &tv) < 0) {
+		log_warning("metrics: event_add failed: %s", strerror(errno));
+		close_conn(c);
+	}
+}
+
+/* returns false if still waiting for request */
+static bool read_request(MetricsConn *c)
+{
+	int got;
+
+	got = safe_recv(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len, 0);
+	if (got < 0 && errno == EAGAIN)
+		return false;
+	if (got <= 0) {
+		c->step = MS_DONE;
+		return true;
+	}
+	c->req_len += got;
+	c->req[c->req_len] = 0;
+
+	if (!strstr(c->req, "\r\n\r\n") && !strstr(c->req, "\n\n")) {
+		if (c->req_len < (int)sizeof(c->req) - 1)
+			return false;
+		c->step = MS_NOT_FOUND;
+		return true;
+	}
+
+	if (strncmp(c->req, "GET /metrics", 12) == 0 && strchr(" ?", c->req[12]))
+		c->step = MS_HEADER;
+	else
+		c->step = MS_NOT_FOUND;
+	return true;
+}
+
+static void write_response(MetricsConn *c)
+{
+	int res;
+
+	while (1) {
+		if (c->buf_pos == c->buf_len) {
+			render(c);
+			if (c->buf_len == 0) {
+				close_conn(c);
+				return;
+			}
+		}
+		res = safe_send(c->fd, c->buf + c->buf_pos, c->buf_len - c->buf_pos, 0);
+		if (res < 0 && errno == EAGAIN) {
+			wait_conn(c, EV_WRITE);
+			return;
+		} else if (res <= 0) {
+			close_conn(c);
+			return;
+		}
+		c->buf_pos += res;
+	}
+}
+
+static void conn_cb(int fd, short flags, void *arg)
+{
+	MetricsConn *c = arg;
+
+	if (flags & EV_TIMEOUT) {
+		log_debug("metrics: connection timed out");
+		close_conn(c);
+		return;
+	}
+	if (c->step == MS_READ && !read_request(c)) {
+		wait_conn(c, EV_READ);
+		return;
+	}
+	write_response(c);
+}
+
+static void metrics_accept(int sock, short flags, void *arg)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	MetricsConn *c;
+	int fd;
+
+	fd = safe_accept(sock, (struct sockaddr *)&sa, &len);
+	if (fd < 0)
+		return;
+
+	if (conn_count >= MAX_METRICS_CONN) {
+		log_warning("metrics: too many connections");
+		safe_close(fd);
+		return;
+	}
+	c = malloc(sizeof(*c));
+	if (!c) {
+		safe_close(fd);
+		return;
+	}
+	memset(c, 0, offsetof(MetricsConn, buf));
+	list_init(&c->head);
+	list_append(&c->head, &conn_list);
+	conn_count++;
+	c->fd = fd;
+	c->step = MS_READ;
+	socket_set_nonblocking(fd, 1);
+	wait_conn(c, EV_READ);
+}
+
+/* pool is going away, move cursors past it */
+void metrics_forget_pool(PgPool *pool)
+{
+	MetricsConn *c;
+	List *item;
+
+	list_for_each(item, &conn_list) {
+		c = container_of(item, MetricsConn, head);
+		if (c->pool == pool)
+			c->pool = next_pool(pool);
+	}
+}
+
+static bool create_listener(void)
+{
+	struct sockaddr_in sa;
+	int sock, val = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(cf_metrics_port);
+	if (strcmp(cf_metrics_addr, "*") == 0) {
+		sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	} else {
+		sa.sin_addr.s_addr = inet_addr(cf_metrics_addr);
+		if (sa.sin_addr.s_addr == INADDR_NONE)
+			fatal("cannot parse metrics_addr: '%s'", cf_metrics_addr);
+	}
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		log_error("metrics: socket: %s", strerror(errno));
+		return false;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+	if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0
+	    || listen(sock, 16) < 0) {
+		log_warning("metrics: cannot listen on %s:%d: %s, will retry",
+			    cf_metrics_addr, cf_metrics_port, strerror(errno));
+		safe_close(sock);
+		return false;
+	}
+	tune_socket(sock, false);
+
+	event_set(&ev_listen, sock, EV_READ | EV_PERSIST, metrics_accept, NULL);
+	if (event_add(&ev_listen, NULL) < 0) {
+		log_error("metrics: event_add failed: %s", strerror(errno));
+		safe_close(sock);
+		return false;
+	}
+	fd_metrics = sock;
+	log_info("metrics on http://%s:%d/metrics", cf_metrics_addr, cf_metrics_port);
+	return true;
+}
+
+/*
+ * Called on startup and from janitor.  After online restart
+ * the old process may still hold the port for a while.
+ */
+void metrics_setup(void)
+{
+	if (!cf_metrics_port || fd_metrics >= 0)
+		return;
+	if (next_try > get_cached_time())
+		return;
+	if (!create_listener())
+		next_try = get_cached_time() + METRICS_RETRY * USEC;
+}
@@ -28,6 +28,7 @@ STATLIST(database_list);
 STATLIST(pool_list);
 
 Tree user_tree;
+Tree database_tree;
 
 /*
  * client and server objects will be pre-allocated
@@ -54,6 +55,8 @@ static STATLIST(justfree_server_list);
 /* init autodb idle list */
 STATLIST(autodatabase_idle_list);
 
+static void arm_wait_timer(PgPool *pool);
+
 /* fast way to get number of active clients */
 int get_active_client_count(void)
 {
@@ -94,16 +97,28 @@ static int user_node_cmp(long userptr, Node *node)
 	return strcmp(name, user->name);
 }
 
+/* compare string with PgDatabase->name, for usage with btree */
+static int db_node_cmp(long nameptr, Node *node)
+{
+	const char *name = (const char *)nameptr;
+	PgDatabase *db = container_of(node, PgDatabase, tree_node);
+	return strcmp(name, db->name);
+}
+
 /* initialization before config loading */
 void init_objects(void)
 {
 	tree_init(&user_tree, user_node_cmp, NULL);
+	tree_init(&database_tree, db_node_cmp, NULL);
 	user_cache = objcache_create("user_cache", sizeof(PgUser), 0, NULL);
 	db_cache = objcache_create("db_cache", sizeof(PgDatabase), 0, NULL);
 	pool_cache = objcache_create("pool_cache", sizeof(PgPool), 0, NULL);
 
 	if (!user_cache || !db_cache || !pool_cache)
 		fatal("cannot create initial caches");
+
+	init_hosts();
+	auth_query_setup();
 }
 
 static void do_iobuf_reset(void *arg)
@@ -120,6 +135,189 @@ void init_caches(void)
 	iobuf_cache = objcache_create("iobuf_cache", IOBUF_SIZE, 0, do_iobuf_reset);
 }
 
+/*
+ * Move unlinked active client to another pool of same user,
+ * used for routing read-only transactions to replica.
+ */
+void switch_client_pool(PgSocket *client, PgPool *pool)
+{
+	Assert(client->state == CL_ACTIVE);
+	Assert(!client->link);
+
+	if (client->pool == pool)
+		return;
+	statlist_remove(&client->head, &client->pool->active_client_list);
+	client->pool = pool;
+	client->sbuf.budget = &pool->loop_budget;
+	statlist_append(&client->head, &pool->active_client_list);
+}
+
+/*
+ * waiting_client_list is kept ordered by wait_class, FIFO inside
+ * class.  pool->wait_first[] points to first client of each class,
+ * so both insert and remove stay O(1).
+ */
+static void wait_queue_add(PgPool *pool, PgSocket *client)
+{
+	int i, cls = client->wait_class;
+	PgSocket *next = NULL;
+
+	/* put before first client of lower class */
+	for (i = cls + 1; i < WAIT_CLASSES && !next; i++)
+		next = pool->wait_first[i];
+	if (next)
+		statlist_put_before(&client->head, &pool->waiting_client_list, &next->head);
+	else
+		statlist_append(&client->head, &pool->waiting_client_list);
+
+	if (!pool->wait_first[cls])
+		pool->wait_first[cls] = client;
+	pool->wait_count[cls]++;
+
+	client->wait_start = get_cached_time();
+	arm_wait_timer(pool);
+}
+
+static void wait_queue_remove(PgPool *pool, PgSocket *client)
+{
+	int cls = client->wait_class;
+	List *next = client->head.next;
+	PgSocket *sk;
+	usec_t wait;
+
+	if (pool->wait_first[cls] == client) {
+		sk = NULL;
+		if (next != &pool->waiting_client_list.head) {
+			sk = container_of(next, PgSocket, head);
+			if (sk->wait_class != cls)
+				sk = NULL;
+		}
+		pool->wait_first[cls] = sk;
+	}
+	statlist_remove(&client->head, &pool->waiting_client_list);
+	pool->wait_count[cls]--;
+
+	wait = get_cached_time() - client->wait_start;
+	pool->stats.wait_time += wait;
+	client->stats.wait_time += wait;
+	if (cf_log_slow_wait > 0 && wait >= cf_log_slow_wait)
+		log_slow(client, "wait", wait);
+}
+
+/* client who has waited longest, it may not be first in list */
+PgSocket *oldest_waiting_client(PgPool *pool)
+{
+	PgSocket *sk, *oldest = NULL;
+	int i;
+
+	for (i = 0; i < WAIT_CLASSES; i++) {
+		sk = pool->wait_first[i];
+		if (sk && (!oldest || sk->wait_start < oldest->wait_start))
+			oldest = sk;
+	}
+	return oldest;
+}
+
+/*
+ * query_wait_timeout is enforced with per-pool timer that is set
+ * to fire when oldest waiting client reaches the limit.
+ */
+static void wait_timer_cb(int fd, short flags, void *arg)
+{
+	PgPool *pool = arg;
+	PgSocket *client;
+	usec_t now = get_cached_time();
+
+	pool->wait_timer_set = 0;
+	while (cf_query_wait_timeout > 0) {
+		client = oldest_waiting_client(pool);
+		if (!client || now - client->wait_start < cf_query_wait_timeout)
+			break;
+		disconnect_client(client, true, "query_wait_timeout");
+	}
+	arm_wait_timer(pool);
+}
+
+static void arm_wait_timer(PgPool *pool)
+{
+	PgSocket *client;
+	usec_t now, left = 0;
+	struct timeval tv;
+
+	if (pool->wait_timer_set || cf_query_wait_timeout <= 0)
+		return;
+	client = oldest_waiting_client(pool);
+	if (!client)
+		return;
+
+	now = get_cached_time();
+	if (now - client->wait_start < cf_query_wait_timeout)
+		left = cf_query_wait_timeout - (now - client->wait_start);
+	tv.tv_sec = left / USEC;
+	tv.tv_usec = left % USEC;
+
+	evtimer_set(&pool->wait_timer, wait_timer_cb, pool);
+	if (evtimer_add(&pool->wait_timer, &tv) < 0) {
+		/* next waiting client tries again */
+		log_warning("arm_wait_timer: evtimer_add failed: %s", strerror(errno));
+		return;
+	}
+	pool->wait_timer_set = 1;
+}
+
+void stop_wait_timer(PgPool *pool)
+{
+	if (pool->wait_timer_set) {
+		evtimer_del(&pool->wait_timer);
+		pool->wait_timer_set = 0;
+	}
+}
+
+/* query_wait_timeout changed, apply it to clients already waiting */
+void reset_wait_timers(void)
+{
+	List *item;
+	PgPool *pool;
+
+	statlist_for_each(item, &pool_list) {
+		pool = container_of(item, PgPool, head);
+		stop_wait_timer(pool);
+		arm_wait_timer(pool);
+	}
+}
+
+/*
+ * Would the client wait longer than query_wait_timeout?
+ *
+ * Estimate is made from clients ahead in queue and average
+ * query time in last stats period.
+ */
+static bool wait_too_long(PgSocket *client)
+{
+	PgPool *pool = client->pool;
+	PgStats *old = &pool->older_stats, *cur = &pool->newer_stats;
+	uint64_t count, avg, ahead = 0;
+	int i;
+
+	if (!cf_query_wait_shed || cf_query_wait_timeout <= 0)
+		return false;
+	if (cf_pause_mode != P_NONE || pool->db->db_paused)
+		return false;
+	/* new servers are coming, estimate does not apply */
+	if (pool->db->pool_size <= 0 || pool_server_count(pool) < pool->db->pool_size)
+		return false;
+
+	count = cur->request_count - old->request_count;
+	if (count == 0)
+		return false;
+	avg = (cur->query_time - old->query_time) / count;
+
+	for (i = 0; i <= client->wait_class; i++)
+		ahead += pool->wait_count[i];
+
+	return (ahead + 1) * avg / pool->db->pool_size > cf_query_wait_timeout;
+}
+
 /* state change means moving between lists */
 void change_client_state(PgSocket *client, SocketState newstate)
 {
@@ -136,7 +334,7 @@ void change_client_state(PgSocket *client, SocketState newstate)
 		statlist_remove(&client->head, &login_client_list);
 		break;
 	case CL_WAITING:
-		statlist_remove(&client->head, &pool->waiting_client_list);
+		wait_queue_remove(pool, client);
 		break;
 	case CL_ACTIVE:
 		statlist_remove(&client->head, &pool->active_client_list);
@@ -162,7 +360,7 @@ void change_client_state(PgSocket *client, SocketState newstate)
 		statlist_append(&client->head, &login_client_list);
 		break;
 	case CL_WAITING:
-		statlist_append(&client->head, &pool->waiting_client_list);
+		wait_queue_add(pool, client);
 		break;
 	case CL_ACTIVE:
 		statlist_append(&client->head, &pool->active_client_list);
@@ -201,6 +399,8 @@ void change_server_state(PgSocket *server, SocketState newstate)
 		break;
 	case SV_ACTIVE:
 		statlist_remove(&server->head, &pool->active_server_list);
+		if (server->host)
+			server->host->active_count--;
 		break;
 	default:
 		fatal("change_server_state: bad old server state: %d", server->state);
@@ -211,9 +411,11 @@ void change_server_state(PgSocket *server, SocketState newstate)
 	/* put to new location */
 	switch (server->state) {
 	case SV_FREE:
+		host_server_drop(server);
 		obj_free(server_cache, server);
 		break;
 	case SV_JUSTFREE:
+		host_server_drop(server);
 		statlist_append(&server->head, &justfree_server_list);
 		break;
 	case SV_LOGIN:
@@ -236,6 +438,8 @@ void change_server_state(PgSocket *server, SocketState newstate)
 		break;
 	case SV_ACTIVE:
 		statlist_append(&server->head, &pool->active_server_list);
+		if (server->host)
+			server->host->active_count++;
 		break;
 	default:
 		fatal("bad server state");
@@ -276,6 +480,15 @@ static void put_in_order(List *newitem, StatList *list, int (*cmpfn)(List *, Lis
 	int res;
 	List *item;
 
+	/* config files are usually sorted, check end first */
+	if (!statlist_empty(list)) {
+		res = cmpfn(statlist_last(list), newitem);
+		if (res < 0) {
+			statlist_append(newitem, list);
+			return;
+		}
+	}
+
 	statlist_for_each(item, list) {
 		res = cmpfn(item, newitem);
 		if (res == 0)
@@ -302,11 +515,28 @@ PgDatabase *add_database(const char *name)
 		list_init(&db->head);
 		safe_strcpy(db->name, name, sizeof(db->name));
 		put_in_order(&db->head, &database_list, cmp_database);
+		tree_insert(&database_tree, (long)db->name, &db->tree_node);
 	}
 
 	return db;
 }
 
+/*
+ * Sockets of one pool can read pool_loop_budget * budget_weight
+ * bytes in one event loop, so one busy pool cannot starve others.
+ */
+void reset_pool_budget(PgPool *pool)
+{
+	int weight = pool->db->budget_weight;
+
+	if (cf_pool_loop_budget <= 0 || pool->db->admin)
+		pool->loop_budget = INT_MAX;
+	else if (weight > INT_MAX / cf_pool_loop_budget)
+		pool->loop_budget = INT_MAX;
+	else
+		pool->loop_budget = cf_pool_loop_budget * weight;
+}
+
 /* register new auto database */
 PgDatabase *register_auto_database(const char *name)
 {
@@ -338,10 +568,19 @@ PgDatabase *register_auto_database(const char *name)
 	return db;
 }
 
+/* search only users already in memory */
+static PgUser *lookup_user(const char *name)
+{
+	Node *node;
+
+	node = tree_search(&user_tree, (long)name);
+	return node ? container_of(node, PgUser, tree_node) : NULL;
+}
+
 /* add or update client users */
 PgUser *add_user(const char *name, const char *passwd)
 {
-	PgUser *user = find_user(name);
+	PgUser *user = lookup_user(name);
 
 	if (user == NULL) {
 		user = obj_alloc(user_cache);
@@ -359,6 +598,23 @@ PgUser *add_user(const char *name, const char *passwd)
 	return user;
 }
 
+/* add new user in front of 'pos' in user_list, caller keeps the order */
+PgUser *insert_user(const char *name, const char *passwd, List *pos)
+{
+	PgUser *user = obj_alloc(user_cache);
+	if (!user)
+		return NULL;
+
+	list_init(&user->head);
+	list_init(&user->pool_list);
+	safe_strcpy(user->name, name, sizeof(user->name));
+	safe_strcpy(user->passwd, passwd, sizeof(user->passwd));
+	statlist_put_before(&user->head, &user_list, pos);
+
+	tree_insert(&user_tree, (long)user->name, &user->tree_node);
+	return user;
+}
+
 /* create separate user object for storing server user info */
 PgUser *force_user(PgDatabase *db, const char *name, const char *passwd)
 {
@@ -379,34 +635,30 @@ PgUser *force_user(PgDatabase *db, const char *name, const char *passwd)
 /* find an existing database */
 PgDatabase *find_database(const char *name)
 {
-	List *item, *tmp;
 	PgDatabase *db;
-	statlist_for_each(item, &database_list) {
-		db = container_of(item, PgDatabase, head);
-		if (strcmp(db->name, name) == 0)
-			return db;
-	}
-	/* also trying to find in idle autodatabases list */
-	statlist_for_each_safe(item, &autodatabase_idle_list, tmp) {
-		db = container_of(item, PgDatabase, head);
-		if (strcmp(db->name, name) == 0) {
-			db->inactive_time = 0;
-			statlist_remove(&db->head, &autodatabase_idle_list);
-			put_in_order(&db->head, &database_list, cmp_database);
-			return db;
-		}
+	Node *node;
+
+	node = tree_search(&database_tree, (long)name);
+	if (!node)
+		return NULL;
+	db = container_of(node, PgDatabase, tree_node);
+
+	/* idle autodatabase becomes active again */
+	if (db->inactive_time) {
+		db->inactive_time = 0;
+		statlist_remove(&db->head, &autodatabase_idle_list);
+		put_in_order(&db->head, &database_list, cmp_database);
 	}
-	return NULL;
+	return db;
 }
 
-/* find existing user */
+/* find existing user, users from compiled auth file are loaded on demand */
 PgUser *find_user(const char *name)
 {
-	PgUser *user = NULL;
-	Node *node;
+	PgUser *user = lookup_user(name);
 
-	node = tree_search(&user_tree, (long)name);
-	user = node ? container_of(node, PgUser, tree_node) : NULL;
+	if (!user && authdb_active())
+		user = authdb_get_user(name);
 	return user;
 }
 
@@ -436,6 +688,8 @@ static PgPool *new_pool(PgDatabase *db, PgUser *user)
 
 	list_append(&pool->map_head, &user->pool_list);
 
+	reset_pool_budget(pool);
+
 	/* keep pools in db/user order to make stats faster */
 	put_in_order(&pool->head, &pool_list, cmp_pool);
 
@@ -487,6 +741,31 @@ void activate_client(PgSocket *client)
 	sbuf_continue(&client->sbuf);
 }
 
+/*
+ * With several hosts, prefer idle server on least loaded host.
+ * Default pick is kept if it is as good as any other.
+ */
+static PgSocket *pick_idle_server(PgPool *pool, PgSocket *server)
+{
+	List *item;
+	PgSocket *sk, *best = server;
+
+	if (!best->host)
+		return best;
+
+	statlist_for_each(item, &pool->idle_server_list) {
+		sk = container_of(item, PgSocket, head);
+		if (!sk->host || sk->close_needed || !sk->ready)
+			continue;
+		if (host_better(sk->host, best->host)) {
+			best = sk;
+			if (best->host->active_count == 0)
+				break;
+		}
+	}
+	return best;
+}
+
 /* link if found, otherwise put into wait queue */
 bool find_server(PgSocket *client)
 {
@@ -518,6 +797,9 @@ bool find_server(PgSocket *client)
 	}
 	Assert(!server || server->state == SV_IDLE);
 
+	if (server && pool->db->host_count > 1)
+		server = pick_idle_server(pool, server);
+
 	/* send var changes */
 	if (server) {
 		res = varcache_apply(server, client, &varchange);
@@ -532,6 +814,7 @@ bool find_server(PgSocket *client)
 		client->link = server;
 		server->link = client;
 		change_server_state(server, SV_ACTIVE);
+		PROBE_CLIENT_LINK(client, server);
 		if (varchange) {
 			server->setting_vars = 1;
 			server->ready = 0;
@@ -540,7 +823,11 @@ bool find_server(PgSocket *client)
 				disconnect_client(client, true, "pause failed");
 		} else
 			res = true;
+	} else if (wait_too_long(client)) {
+		disconnect_client(client, true, "query_wait_timeout (estimated)");
+		res = false;
 	} else {
+		PROBE_CLIENT_WAIT(client);
 		pause_client(client);
 		res = false;
 	}
@@ -576,9 +863,14 @@ static bool reset_on_release(PgSocket *server)
 
 	slog_debug(server, "Resetting: %s", cf_server_reset_query);
 	SEND_generic(res, server, 'Q', "s", cf_server_reset_query);
-	if (!res)
+	if (!res) {
 		disconnect_server(server, false, "reset query failed");
-	return res;
+		return false;
+	}
+
+	/* reset query resets also parameters that server does not report */
+	varcache_clean_local(&server->vars);
+	return true;
 }
 
 static bool life_over(PgSocket *server)
@@ -609,11 +901,15 @@ bool release_server(PgSocket *server)
 
 	Assert(server->ready);
 
+	cache_fill_abort(server);
+
 	/* remove from old list */
 	switch (server->state) {
 	case SV_ACTIVE:
+		PROBE_SERVER_RELEASE(server, server->link);
 		server->link->link = NULL;
 		server->link = NULL;
+		server->rfq_pending = 0;
 
 		if (*cf_server_reset_query)
 			/* notify reset is required */
@@ -669,10 +965,13 @@ void disconnect_server(PgSocket *server, bool notify, const char *reason)
 	int send_term = 1;
 	usec_t now = get_cached_time();
 
+	PROBE_SERVER_DISCONNECT(server, reason);
 	if (cf_log_disconnections)
 		slog_info(server, "closing because: %s (age=%llu)", reason,
 			  (now - server->connect_time) / USEC);
 
+	cache_fill_abort(server);
+
 	switch (server->state) {
 	case SV_ACTIVE:
 		client = server->link;
@@ -719,10 +1018,15 @@ void disconnect_client(PgSocket *client, bool notify, const char *reason)
 {
 	usec_t now = get_cached_time();
 
+	PROBE_CLIENT_DISCONNECT(client, reason);
 	if (cf_log_disconnections)
 		slog_info(client, "closing because: %s (age=%llu)", reason,
 			  (now - client->connect_time) / USEC);
 
+	auth_query_abort(client);
+	if (client->pool && client->pool->db->admin)
+		admin_stream_abort(client);
+
 	switch (client->state) {
 	case CL_ACTIVE:
 		if (client->link) {
@@ -763,6 +1067,7 @@ void disconnect_client(PgSocket *client, bool notify, const char *reason)
 void launch_new_connection(PgPool *pool)
 {
 	PgSocket *server;
+	PgHost *host;
 	int total;
 	const char *unix_dir = cf_unix_socket_dir;
 	bool res;
@@ -773,8 +1078,18 @@ void launch_new_connection(PgPool *pool)
 		return;
 	}
 
-	/* if server bounces, don't retry too fast */
-	if (pool->last_connect_failed) {
+	/* down hosts are skipped, if nothing is left wait for retry */
+	host = pick_host(pool->db);
+	if (!host && pool->db->host_count > 0) {
+		log_debug("launch_new_connection: all hosts down, wait");
+		return;
+	}
+
+	/*
+	 * If server bounces, don't retry too fast.  Failover to
+	 * another host does not need to wait.
+	 */
+	if (pool->last_connect_failed && host == pool->last_connect_host) {
 		usec_t now = get_cached_time();
 		if (now - pool->last_connect_time < cf_server_login_retry) {
 			log_debug("launch_new_connection: last failed, wait");
@@ -788,7 +1103,7 @@ void launch_new_connection(PgPool *pool)
 		/* should we use reserve pool? */
 		if (cf_res_pool_timeout && pool->db->res_pool_size) {
 			usec_t now = get_cached_time();
-			PgSocket *c = first_socket(&pool->waiting_client_list);
+			PgSocket *c = oldest_waiting_client(pool);
 			if (c && (now - c->request_time) >= cf_res_pool_timeout) {
 				if (total < pool->db->pool_size + pool->db->res_pool_size) {
 					log_debug("reserve_pool activated");
@@ -811,10 +1126,16 @@ allow_new:
 
 	/* initialize it */
 	server->pool = pool;
+	server->sbuf.budget = &pool->loop_budget;
 	server->auth_user = server->pool->user;
-	server->remote_addr = server->pool->db->addr;
+	if (host) {
+		host_server_add(host, server);
+		server->remote_addr = host->addr;
+	} else
+		server->remote_addr = server->pool->db->addr;
 	server->connect_time = get_cached_time();
 	pool->last_connect_time = get_cached_time();
+	pool->last_connect_host = host;
 	change_server_state(server, SV_LOGIN);
 
 	if (cf_log_connections)
@@ -831,9 +1152,15 @@ allow_new:
 		log_noise("failed to launch new connection");
 }
 
-/* new client connection attempt */
+/*
+ * New client connection attempt.
+ *
+ * Addresses are taken from accept() and listening socket when known,
+ * NULL means they need to be queried from socket.
+ */
 PgSocket * accept_client(int sock,
-			 const struct sockaddr_in *addr,
+			 const PgAddr *remote_addr,
+			 const PgAddr *local_addr,
 			 bool is_unix)
 {
 	bool res;
@@ -850,8 +1177,14 @@ PgSocket * accept_client(int sock,
 	client->connect_time = client->request_time = get_cached_time();
 	client->query_start = 0;
 
-	fill_remote_addr(client, sock, is_unix);
-	fill_local_addr(client, sock, is_unix);
+	if (remote_addr)
+		client->remote_addr = *remote_addr;
+	else
+		fill_remote_addr(client, sock, is_unix);
+	if (local_addr)
+		client->local_addr = *local_addr;
+	else
+		fill_local_addr(client, sock, is_unix);
 
 	change_client_state(client, CL_LOGIN);
 
@@ -879,6 +1212,10 @@ bool finish_client_login(PgSocket *client)
 	}
 
 	if (!welcome_client(client)) {
+		if (hosts_unresolved(client->pool->db)) {
+			disconnect_client(client, true, "server login failed: cannot resolve host");
+			return false;
+		}
 		log_debug("finish_client_login: no welcome message, pause");
 		client->wait_for_welcome = 1;
 		pause_client(client);
@@ -889,6 +1226,7 @@ bool finish_client_login(PgSocket *client)
 	client->wait_for_welcome = 0;
 
 	slog_debug(client, "logged in");
+	PROBE_CLIENT_LOGIN(client);
 
 	return true;
 }
@@ -980,12 +1318,13 @@ bool use_client_socket(int fd, PgAddr *addr,
 	PgSocket *client;
 	PktBuf tmp;
 
-	client = accept_client(fd, NULL, addr->is_unix);
+	tune_socket(fd, addr->is_unix);
+	client = accept_client(fd, NULL, NULL, addr->is_unix);
 	if (client == NULL)
 		return false;
 	client->suspended = 1;
 
-	if (!set_pool(client, dbname, username))
+	if (!set_pool(client, dbname, username, false, true))
 		return false;
 
 	change_client_state(client, CL_ACTIVE);
@@ -1018,6 +1357,7 @@ bool use_server_socket(int fd, PgAddr *addr,
 	PgSocket *server;
 	PktBuf tmp;
 	bool res;
+	int i;
 	
 	/* if the database not found, it's an auto database -> registering... */
 	if (!db) {
@@ -1029,7 +1369,9 @@ bool use_server_socket(int fd, PgAddr *addr,
 	if (db->forced_user)
 		user = db->forced_user;
 	else
-		user = find_user(username);
+		user = auth_query_user(username);
+	if (!user)
+		return false;
 
 	pool = get_pool(db, user);
 	if (!pool)
@@ -1039,12 +1381,14 @@ bool use_server_socket(int fd, PgAddr *addr,
 	if (!server)
 		return false;
 
+	tune_socket(fd, addr->is_unix);
 	res = sbuf_accept(&server->sbuf, fd, addr->is_unix);
 	if (!res)
 		return false;
 
 	server->suspended = 1;
 	server->pool = pool;
+	server->sbuf.budget = &pool->loop_budget;
 	server->auth_user = user;
 	server->connect_time = server->request_time = get_cached_time();
 	server->query_start = 0;
@@ -1052,6 +1396,16 @@ bool use_server_socket(int fd, PgAddr *addr,
 	fill_remote_addr(server, fd, addr->is_unix);
 	fill_local_addr(server, fd, addr->is_unix);
 
+	/* find which of the hosts it is connected to */
+	for (i = 0; i < db->host_count; i++) {
+		PgHost *host = db->hosts[i];
+		if (host->addr.ip_addr.s_addr == server->remote_addr.ip_addr.s_addr
+		    && host->addr.port == server->remote_addr.port) {
+			host_server_add(host, server);
+			break;
+		}
+	}
+
 	if (linkfd) {
 		server->ready = 0;
 		change_server_state(server, SV_ACTIVE);
@@ -1101,6 +1455,88 @@ static void tag_dirty(PgSocket *sk)
 	sk->close_needed = 1;
 }
 
+/* host for for_each_server() callbacks below */
+static PgHost *walk_host;
+
+static void tag_host_server(PgSocket *sk)
+{
+	if (sk->host == walk_host)
+		sk->close_needed = 1;
+}
+
+/* host address changed, connections to it should go */
+void tag_host_dirty(PgHost *host)
+{
+	List *item;
+	PgPool *pool;
+
+	walk_host = host;
+	statlist_for_each(item, &pool_list) {
+		pool = container_of(item, PgPool, head);
+		for_each_server(pool, tag_host_server);
+	}
+	walk_host = NULL;
+}
+
+static void adopt_host_server(PgSocket *sk)
+{
+	PgDatabase *db = sk->pool->db;
+	int i;
+
+	if (sk->host || sk->remote_addr.is_unix
+	    || sk->remote_addr.ip_addr.s_addr != walk_host->addr.ip_addr.s_addr
+	    || sk->remote_addr.port != walk_host->addr.port)
+		return;
+
+	for (i = 0; i < db->host_count; i++) {
+		if (db->hosts[i] != walk_host)
+			continue;
+		host_server_add(walk_host, sk);
+		if (sk->state == SV_ACTIVE)
+			walk_host->active_count++;
+		break;
+	}
+}
+
+/*
+ * Servers taken over from old process may be connected to a host
+ * that was not resolved yet, attribute them once it is.
+ */
+void adopt_host_servers(PgHost *host)
+{
+	List *item;
+	PgPool *pool;
+
+	walk_host = host;
+	statlist_for_each(item, &pool_list) {
+		pool = container_of(item, PgPool, head);
+		for_each_server(pool, adopt_host_server);
+	}
+	walk_host = NULL;
+}
+
+/*
+ * Clients waiting for first server of database whose hosts cannot
+ * be resolved get error instead of waiting for next lookup.
+ */
+void kill_unresolved_logins(void)
+{
+	List *item, *citem, *tmp;
+	PgPool *pool;
+	PgSocket *client;
+
+	statlist_for_each(item, &pool_list) {
+		pool = container_of(item, PgPool, head);
+		if (pool->welcome_msg_ready || !hosts_unresolved(pool->db))
+			continue;
+		statlist_for_each_safe(citem, &pool->waiting_client_list, tmp) {
+			client = container_of(citem, PgSocket, head);
+			if (client->wait_for_welcome)
+				disconnect_client(client, true, "server login failed: cannot resolve host");
+		}
+	}
+}
+
 void tag_database_dirty(PgDatabase *db)
 {
 	List *item;
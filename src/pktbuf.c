@@ -22,7 +22,7 @@
 
 #include "bouncer.h"
 
-static void pktbuf_free(PktBuf *buf)
+void pktbuf_free(PktBuf *buf)
 {
 	if (buf->fixed_buf)
 		return;
@@ -87,31 +87,57 @@ static void pktbuf_send_func(int fd, short flags, void *arg)
 
 	log_debug("pktbuf_send_func(%d, %d, %p)", fd, (int)flags, buf);
 
-	if (buf->failed)
-		return;
+	if (buf->failed) {
+		if (!buf->refill)
+			return;
+		log_error("pktbuf_send_func: no mem for stream");
+		goto failed;
+	}
+
+	/* stream: previous chunk is out, ask for next one */
+	if (buf->refill && buf->send_pos == buf->write_pos) {
+		buf->send_pos = buf->write_pos = 0;
+		if (!buf->refill(buf, buf->refill_arg)) {
+			pktbuf_free(buf);
+			return;
+		}
+		if (buf->failed) {
+			log_error("pktbuf_send_func: no mem for next chunk");
+			goto failed;
+		}
+	}
 
 	amount = buf->write_pos - buf->send_pos;
 	res = safe_send(fd, buf->buf + buf->send_pos, amount, 0);
 	if (res < 0) {
-		if (res == EAGAIN) {
+		if (errno == EAGAIN) {
 			res = 0;
 		} else {
 			log_error("pktbuf_send_func: %s", strerror(errno));
-			pktbuf_free(buf);
-			return;
+			goto failed;
 		}
 	}
 	buf->send_pos += res;
 
-	if (buf->send_pos < buf->write_pos) {
+	/*
+	 * Stream is continued from next event loop round,
+	 * so other sockets get their turn between chunks.
+	 */
+	if (buf->send_pos < buf->write_pos || buf->refill) {
 		event_set(buf->ev, fd, EV_WRITE, pktbuf_send_func, buf);
 		res = event_add(buf->ev, NULL);
 		if (res < 0) {
 			log_error("pktbuf_send_func: %s", strerror(errno));
-			pktbuf_free(buf);
+			goto failed;
 		}
 	} else
 		pktbuf_free(buf);
+	return;
+
+failed:
+	if (buf->refill)
+		buf->refill(NULL, buf->refill_arg);
+	pktbuf_free(buf);
 }
 
 bool pktbuf_send_queued(PktBuf *buf, PgSocket *sk)
@@ -131,6 +157,38 @@ bool pktbuf_send_queued(PktBuf *buf, PgSocket *sk)
 	}
 }
 
+/*
+ * Send buffer contents, then keep calling refill() for more
+ * until it returns false.  Unlike pktbuf_send_queued() nothing is
+ * sent immidiately, all work happens in event callbacks.  On failure
+ * the buffer is freed and refill() is not called.
+ */
+bool pktbuf_send_stream(PktBuf *buf, PgSocket *sk, pktbuf_refill_f refill, void *arg)
+{
+	int fd = sbuf_socket(&sk->sbuf);
+
+	Assert(!buf->sending);
+	Assert(!buf->fixed_buf);
+
+	buf->sending = 1;
+	buf->refill = refill;
+	buf->refill_arg = arg;
+	event_set(buf->ev, fd, EV_WRITE, pktbuf_send_func, buf);
+	if (event_add(buf->ev, NULL) < 0) {
+		log_error("pktbuf_send_stream: %s", strerror(errno));
+		pktbuf_free(buf);
+		return false;
+	}
+	return true;
+}
+
+/* stop streaming and release the buffer, refill() is not called */
+void pktbuf_cancel(PktBuf *buf)
+{
+	event_del(buf->ev);
+	pktbuf_free(buf);
+}
+
 static void make_room(PktBuf *buf, int len)
 {
 	int newlen = buf->buf_len;
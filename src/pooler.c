@@ -39,6 +39,16 @@ static bool pooler_active = false;
 static struct event ev_err;
 static struct timeval err_timeout = {5, 0};
 
+/*
+ * Max connections to accept in one go.  Rest are taken on
+ * next loop, so that existing clients are not starved.
+ */
+#define MAX_ACCEPT_LOOP 64
+
+/* local address of accepted sockets, taken from listening socket */
+static PgAddr net_local_addr;
+static PgAddr unix_local_addr;
+
 /* atexit() cleanup func */
 static void cleanup_unix_socket(void)
 {
@@ -53,6 +63,32 @@ static void cleanup_unix_socket(void)
 	unlink(fn);
 }
 
+/*
+ * Remember listening address, to avoid getsockname() on each
+ * accepted socket.  On wildcard listener it stays INADDR_ANY,
+ * the real one is fetched on demand with get_local_addr().
+ */
+static void remember_local_addr(int sock, bool is_unix)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+
+	if (is_unix) {
+		unix_local_addr.is_unix = true;
+		unix_local_addr.port = cf_listen_port;
+		return;
+	}
+
+	memset(&net_local_addr, 0, sizeof(net_local_addr));
+	if (getsockname(sock, (struct sockaddr *)&sa, &len) < 0) {
+		log_warning("getsockname(%d) = %s", sock, strerror(errno));
+		net_local_addr.port = cf_listen_port;
+		return;
+	}
+	net_local_addr.ip_addr = sa.sin_addr;
+	net_local_addr.port = ntohs(sa.sin_port);
+}
+
 void get_pooler_fds(int *p_net, int *p_unix)
 {
 	*p_net = fd_net;
@@ -106,6 +142,8 @@ static int create_unix_socket(const char *socket_dir, int listen_port)
 	if (res < 0)
 		fatal_perror("chmod");
 
+	remember_local_addr(sock, true);
+
 	log_info("listening on unix:%s", un.sun_path);
 
 	return sock;
@@ -200,6 +238,8 @@ static int create_net_socket(const char *listen_addr, int listen_port)
 
 	tune_accept(sock, cf_tcp_defer_accept);
 
+	remember_local_addr(sock, false);
+
 	log_info("listening on %s:%d", cf_listen_addr, cf_listen_port);
 
 	return sock;
@@ -229,25 +269,26 @@ static const char *addrpair(const PgAddr *src, const PgAddr *dst)
 	return buf;
 }
 
-static const char *conninfo(const PgSocket *sk)
+static const char *conninfo(PgSocket *sk)
 {
 	if (is_server_socket(sk))
 		return addrpair(&sk->local_addr, &sk->remote_addr);
 	else
-		return addrpair(&sk->remote_addr, &sk->local_addr);
+		return addrpair(&sk->remote_addr, get_local_addr(sk));
 }
 
 /* got new connection, associate it with client struct */
 static void pool_accept(int sock, short flags, void *is_unix)
 {
-	int fd;
+	int fd, count = 0;
 	PgSocket *client;
+	PgAddr remote_addr;
 	union {
 		struct sockaddr_in in;
 		struct sockaddr_un un;
 		struct sockaddr sa;
 	} addr;
-	socklen_t len = sizeof(addr);
+	socklen_t len;
 
 	if(!(flags & EV_READ)) {
 		log_warning("No EV_READ in pool_accept");
@@ -255,6 +296,7 @@ static void pool_accept(int sock, short flags, void *is_unix)
 	}
 loop:
 	/* get fd */
+	len = sizeof(addr);
 	fd = safe_accept(sock, &addr.sa, &len);
 	if (fd < 0) {
 		if (errno == EAGAIN)
@@ -274,8 +316,9 @@ loop:
 	}
 
 	log_noise("new fd from accept=%d", fd);
+	tune_accepted_socket(fd, is_unix != NULL);
 	if (is_unix) {
-		{
+		if (cf_verbose > 1) {
 			uid_t uid;
 			gid_t gid;
 			log_noise("getuid(): %d", (int)getuid());
@@ -284,24 +327,31 @@ loop:
 			else
 				log_warning("unix peer uid failed: %s", strerror(errno));
 		}
-		client = accept_client(fd, NULL, true);
+		client = accept_client(fd, &unix_local_addr, &unix_local_addr, true);
 	} else {
-		client = accept_client(fd, &addr.in, false);
+		memset(&remote_addr, 0, sizeof(remote_addr));
+		remote_addr.ip_addr = addr.in.sin_addr;
+		remote_addr.port = ntohs(addr.in.sin_port);
+		client = accept_client(fd, &remote_addr, &net_local_addr, false);
 	}
 
-	if (client)
+	if (client) {
 		slog_debug(client, "P: got connection: %s", conninfo(client));
+		PROBE_CLIENT_ACCEPT(client, client->remote_addr.is_unix);
+	}
 
 	/*
 	 * there may be several clients waiting,
 	 * avoid context switch by looping
 	 */
-	goto loop;
+	if (++count < MAX_ACCEPT_LOOP)
+		goto loop;
 }
 
 bool use_pooler_socket(int sock, bool is_unix)
 {
 	tune_socket(sock, is_unix);
+	remember_local_addr(sock, is_unix);
 
 	if (is_unix)
 		fd_unix = sock;
@@ -352,6 +402,18 @@ void resume_pooler(void)
 	}
 }
 
+/*
+ * Accepted sockets inherit options from listening socket,
+ * so after config reload they need to be set again.
+ */
+void pooler_tune_sockets(void)
+{
+	if (fd_net > 0)
+		tune_socket(fd_net, false);
+	if (fd_unix > 0)
+		tune_socket(fd_unix, true);
+}
+
 /* listen on socket - should happen after all other initializations */
 void pooler_setup(void)
 {
@@ -72,7 +72,11 @@ void sbuf_init(SBuf *sbuf, sbuf_cb_t proto_fn)
 	sbuf->proto_cb = proto_fn;
 }
 
-/* got new socket from accept() */
+/*
+ * Got new socket from accept().
+ *
+ * Socket must be already tuned, see tune_accepted_socket().
+ */
 bool sbuf_accept(SBuf *sbuf, int sock, bool is_unix)
 {
 	bool res;
@@ -80,7 +84,6 @@ bool sbuf_accept(SBuf *sbuf, int sock, bool is_unix)
 	Assert(iobuf_empty(sbuf->io) && sbuf->sock == 0);
 	AssertSanity(sbuf);
 
-	tune_socket(sock, is_unix);
 	sbuf->sock = sock;
 	sbuf->is_unix = is_unix;
 
@@ -254,6 +257,7 @@ bool sbuf_close(SBuf *sbuf)
 		safe_close(sbuf->sock);
 	}
 	sbuf->dst = NULL;
+	sbuf->budget = NULL;
 	sbuf->sock = 0;
 	sbuf->pkt_remain = 0;
 	sbuf->pkt_action = sbuf->wait_send = 0;
@@ -556,6 +560,8 @@ static bool sbuf_actual_recv(SBuf *sbuf, unsigned len)
 		sbuf_call_proto(sbuf, SBUF_EV_RECV_FAILED);
 		return false;
 	}
+	if (got > 0 && sbuf->budget)
+		*sbuf->budget -= got;
 	return true;
 }
 
@@ -612,8 +618,14 @@ try_more:
 	/* make room in buffer */
 	sbuf_try_resync(sbuf, false);
 
-	/* avoid spending too much time on single socket */
-	if (cf_sbuf_loopcnt > 0 && loopcnt >= cf_sbuf_loopcnt) {
+	/*
+	 * Avoid spending too much time on single socket, or on sockets
+	 * of single pool.  Level-triggered event brings the socket back
+	 * on next loop, so there is no need to queue it here.
+	 */
+	if ((cf_sbuf_loopcnt > 0 && loopcnt >= cf_sbuf_loopcnt)
+	    || (sbuf->budget && *sbuf->budget <= 0))
+	{
 		log_debug("loopcnt full");
 		/*
 		 * sbuf_process_pending() avoids some data if buffer is full,
@@ -143,7 +143,10 @@ static bool handle_server_startup(PgSocket *server, PktHdr *pkt)
 
 		/* login ok */
 		slog_debug(server, "server login ok, start accepting queries");
+		PROBE_SERVER_LOGIN(server);
 		server->ready = 1;
+		if (server->host)
+			host_ok(server->host);
 
 		/* got all params */
 		finish_welcome_msg(server);
@@ -177,6 +180,120 @@ static bool handle_server_startup(PgSocket *server, PktHdr *pkt)
 	return res;
 }
 
+/*
+ * Client query got its ReadyForQuery, update pool and client stats.
+ * If the server is out of transaction, the request and transaction
+ * are finished too.
+ */
+static void query_done(PgSocket *server, PgSocket *client, bool ready)
+{
+	PgStats *pst = &server->pool->stats, *cst = &client->stats;
+	usec_t now = get_cached_time();
+	usec_t total;
+
+	pst->query_count++;
+	cst->query_count++;
+	if (client->cur_query_start) {
+		total = now - client->cur_query_start;
+		if (cf_log_slow_query > 0 && total >= cf_log_slow_query)
+			log_slow(client, "query", total);
+	}
+	/* pipelined query is already on server */
+	client->cur_query_start = server->rfq_pending > 0 ? now : 0;
+
+	if (!ready)
+		return;
+
+	if (client->query_start) {
+		total = now - client->query_start;
+		client->query_start = 0;
+		pst->query_time += total;
+		cst->query_time += total;
+		slog_debug(client, "query time: %d us", (int)total);
+	} else {
+		slog_warning(client, "FIXME: query end, but query_start == 0");
+	}
+
+	if (!client->xact_start)
+		return;
+	total = now - client->xact_start;
+	client->xact_start = 0;
+	pst->xact_count++;
+	cst->xact_count++;
+	pst->xact_time += total;
+	cst->xact_time += total;
+	if (cf_log_slow_xact > 0 && total >= cf_log_slow_xact)
+		log_slow(client, "xact", total);
+}
+
+/*
+ * Statement pooling: client managed to leave transaction open.
+ *
+ * Instead of dropping the server, hold the client, roll the
+ * transaction back and then report error to client.  Results of
+ * the query itself are already sent, only ReadyForQuery is missing.
+ *
+ * If client has pipelined more queries, they are already on server
+ * and would run before ROLLBACK, so then the server is dropped.
+ */
+static bool start_abort_tx(PgSocket *server)
+{
+	PgSocket *client = server->link;
+	bool res;
+
+	cache_fill_abort(server);
+	if (!client || client->sbuf.wait_send || server->rfq_pending > 0) {
+		disconnect_server(server, true, "Long transactions not allowed");
+		return false;
+	}
+	if (!sbuf_pause(&client->sbuf)) {
+		disconnect_client(client, true, "pause failed");
+		return false;
+	}
+
+	SEND_generic(res, server, 'Q', "s", "ROLLBACK");
+	if (!res) {
+		disconnect_server(server, true, "failed to send ROLLBACK");
+		return false;
+	}
+	slog_debug(server, "rolling back transaction left open by client");
+	server->abort_tx = 1;
+	return true;
+}
+
+/* eat ROLLBACK results, then let client continue */
+static bool handle_abort_tx(PgSocket *server, PktHdr *pkt)
+{
+	PgSocket *client = server->link;
+
+	switch (pkt->type) {
+	case 'Z':
+		if (mbuf_avail(&pkt->data) == 0)
+			return false;
+		server->tx_state = mbuf_get_char(&pkt->data);
+		if (server->tx_state != 'I' || !client) {
+			disconnect_server(server, true, "ROLLBACK failed");
+			return false;
+		}
+		server->abort_tx = 0;
+		server->ready = 1;
+		sbuf_prepare_skip(&server->sbuf, pkt->len);
+
+		if (!send_pooler_error(client, true, "Long transactions not allowed")) {
+			disconnect_client(client, true, "failed to send error");
+			return false;
+		}
+		query_done(server, client, true);
+		sbuf_continue(&client->sbuf);
+		return true;
+	case 'E':
+		log_server_error("ROLLBACK failed", pkt);
+		break;
+	}
+	sbuf_prepare_skip(&server->sbuf, pkt->len);
+	return true;
+}
+
 /* process packets on logged in connection */
 static bool handle_server_work(PgSocket *server, PktHdr *pkt)
 {
@@ -187,6 +304,12 @@ static bool handle_server_work(PgSocket *server, PktHdr *pkt)
 
 	Assert(!server->pool->db->admin);
 
+	if (server->abort_tx)
+		return handle_abort_tx(server, pkt);
+
+	if (client && client->wait_for_user && !server->setting_vars)
+		return auth_query_packet(server, pkt);
+
 	switch (pkt->type) {
 	default:
 		slog_error(server, "unknown pkt: '%c'", pkt_desc(pkt));
@@ -200,14 +323,20 @@ static bool handle_server_work(PgSocket *server, PktHdr *pkt)
 		if (mbuf_avail(&pkt->data) == 0)
 			return false;
 		state = mbuf_get_char(&pkt->data);
+		server->tx_state = state;
+		if (client && !server->setting_vars && server->rfq_pending > 0)
+			server->rfq_pending--;
 
 		/* set ready only if no tx */
 		if (state == 'I')
 			ready = 1;
 		else if (cf_pool_mode == POOL_STMT) {
-			disconnect_server(server, true,
-					  "Long transactions not allowed");
-			return false;
+			/* client does not get this ReadyForQuery */
+			if (!start_abort_tx(server))
+				return false;
+			server->ready = 0;
+			sbuf_prepare_skip(sbuf, pkt->len);
+			return true;
 		}
 		break;
 
@@ -271,20 +400,17 @@ static bool handle_server_work(PgSocket *server, PktHdr *pkt)
 	server->ready = ready;
 	server->pool->stats.server_bytes += pkt->len;
 
+	if (server->cache_fill)
+		cache_fill_packet(server, pkt);
+
 	if (server->setting_vars) {
 		Assert(client);
 		sbuf_prepare_skip(sbuf, pkt->len);
 	} else if (client) {
 		sbuf_prepare_send(sbuf, &client->sbuf, pkt->len);
-		if (ready && client->query_start) {
-			usec_t total;
-			total = get_cached_time() - client->query_start;
-			client->query_start = 0;
-			server->pool->stats.query_time += total;
-			slog_debug(client, "query time: %d us", (int)total);
-		} else if (ready) {
-			slog_warning(client, "FIXME: query end, but query_start == 0");
-		}
+		client->stats.server_bytes += pkt->len;
+		if (pkt->type == 'Z')
+			query_done(server, client, ready);
 	} else {
 		if (server->state != SV_TESTED)
 			slog_warning(server,
@@ -335,8 +461,17 @@ bool server_proto(SBuf *sbuf, SBufEvent evtype, MBuf *data)
 	if (server->state == SV_JUSTFREE)
 		return false;
 
+	if (evtype != SBUF_EV_READ)
+		trace_event(server, 'S', evtype, NULL);
+
 	switch (evtype) {
 	case SBUF_EV_RECV_FAILED:
+		if (server->host) {
+			if (server->state == SV_LOGIN)
+				host_failed(server);
+			else
+				host_crashed(server->host);
+		}
 		disconnect_server(server, false, "server conn crashed?");
 		break;
 	case SBUF_EV_SEND_FAILED:
@@ -354,6 +489,7 @@ bool server_proto(SBuf *sbuf, SBufEvent evtype, MBuf *data)
 			break;
 		}
 		slog_noise(server, "S: pkt '%c', len=%d", pkt_desc(&pkt), pkt.len);
+		trace_event(server, 'S', evtype, &pkt);
 
 		server->request_time = get_cached_time();
 		switch (server->state) {
@@ -372,10 +508,13 @@ bool server_proto(SBuf *sbuf, SBufEvent evtype, MBuf *data)
 		break;
 	case SBUF_EV_CONNECT_FAILED:
 		Assert(server->state == SV_LOGIN);
+		if (server->host)
+			host_failed(server);
 		disconnect_server(server, false, "connect failed");
 		break;
 	case SBUF_EV_CONNECT_OK:
 		slog_debug(server, "S: connect ok");
+		PROBE_SERVER_CONNECT(server);
 		Assert(server->state == SV_LOGIN);
 		server->request_time = get_cached_time();
 		res = handle_connect(server);
@@ -0,0 +1,276 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Pool stats published in shared memory file.
+ *
+ * Janitor copies counters into mmap()-ed file, so monitoring agents can
+ * read them without talking to the console.  Layout is in shmstats.h.
+ */
+
+#include "bouncer.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/* initial room for pools, grows by doubling */
+#define SHMSTATS_MIN_POOLS	64
+
+static struct ShmStatsHeader *shm_hdr;
+static size_t shm_len;
+static int shm_fd = -1;
+static char shm_path[PATH_MAX];
+
+#define pool_rec(hdr, i) ((struct ShmStatsPool *)((char *)(hdr) + (hdr)->header_size + (size_t)(i) * (hdr)->pool_size))
+
+static size_t segment_size(unsigned max_pools)
+{
+	return sizeof(struct ShmStatsHeader) + (size_t)max_pools * sizeof(struct ShmStatsPool);
+}
+
+static void close_segment(void)
+{
+	if (shm_hdr)
+		munmap(shm_hdr, shm_len);
+	if (shm_fd >= 0)
+		close(shm_fd);
+	shm_hdr = NULL;
+	shm_len = 0;
+	shm_fd = -1;
+	shm_path[0] = 0;
+}
+
+/* extend file and map it again, readers notice from max_pools */
+static bool map_segment(unsigned max_pools)
+{
+	size_t len = segment_size(max_pools);
+	void *ptr;
+
+	if (ftruncate(shm_fd, len) < 0) {
+		log_error("%s: %s", shm_path, strerror(errno));
+		return false;
+	}
+	ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	if (ptr == MAP_FAILED) {
+		log_error("%s: mmap: %s", shm_path, strerror(errno));
+		return false;
+	}
+	if (shm_hdr)
+		munmap(shm_hdr, shm_len);
+	shm_hdr = ptr;
+	shm_len = len;
+	return true;
+}
+
+/* new file is prepared under temp name so readers never see it half done */
+static bool create_segment(const char *fn)
+{
+	char tmp[PATH_MAX];
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+	shm_fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (shm_fd < 0) {
+		log_error("%s: %s", tmp, strerror(errno));
+		return false;
+	}
+	safe_strcpy(shm_path, fn, sizeof(shm_path));
+	if (!map_segment(SHMSTATS_MIN_POOLS))
+		goto failed;
+
+	shm_hdr->magic = SHMSTATS_MAGIC;
+	shm_hdr->version = SHMSTATS_VERSION;
+	shm_hdr->header_size = sizeof(struct ShmStatsHeader);
+	shm_hdr->pool_size = sizeof(struct ShmStatsPool);
+	shm_hdr->max_pools = SHMSTATS_MIN_POOLS;
+	shm_hdr->pid = getpid();
+	shm_hdr->start_time = get_cached_time();
+
+	if (rename(tmp, fn) < 0) {
+		log_error("%s: %s", fn, strerror(errno));
+		goto failed;
+	}
+	log_info("publishing stats in %s", fn);
+	return true;
+failed:
+	unlink(tmp);
+	close_segment();
+	return false;
+}
+
+static void fill_pool(struct ShmStatsPool *rec, PgPool *pool, usec_t now)
+{
+	PgSocket *waiter = oldest_waiting_client(pool);
+
+	safe_strcpy(rec->database, pool->db->name, sizeof(rec->database));
+	safe_strcpy(rec->user, pool->user->name, sizeof(rec->user));
+	rec->request_count = pool->stats.request_count;
+	rec->client_bytes = pool->stats.client_bytes;
+	rec->server_bytes = pool->stats.server_bytes;
+	rec->query_time = pool->stats.query_time;
+	rec->xact_count = pool->stats.xact_count;
+	rec->query_count = pool->stats.query_count;
+	rec->xact_time = pool->stats.xact_time;
+	rec->wait_time = pool->stats.wait_time;
+	rec->maxwait = waiter ? now - waiter->wait_start : 0;
+	rec->cl_active = statlist_count(&pool->active_client_list);
+	rec->cl_waiting = statlist_count(&pool->waiting_client_list);
+	rec->sv_active = statlist_count(&pool->active_server_list);
+	rec->sv_idle = statlist_count(&pool->idle_server_list);
+	rec->sv_used = statlist_count(&pool->used_server_list);
+	rec->sv_tested = statlist_count(&pool->tested_server_list);
+	rec->sv_login = statlist_count(&pool->new_server_list);
+}
+
+/* called from janitor */
+void shmstats_update(void)
+{
+	struct ShmStatsHeader *hdr;
+	unsigned need, max, n = 0;
+	usec_t now = get_cached_time();
+	List *item;
+
+	if (strcmp(shm_path, cf_stats_shm_file) != 0) {
+		close_segment();
+		if (*cf_stats_shm_file)
+			create_segment(cf_stats_shm_file);
+		/* on failure, retry only when setting changes */
+		safe_strcpy(shm_path, cf_stats_shm_file, sizeof(shm_path));
+	}
+	if (!shm_hdr)
+		return;
+
+	need = statlist_count(&pool_list);
+	max = shm_hdr->max_pools;
+	if (need > max) {
+		while (max < need)
+			max *= 2;
+		if (!map_segment(max))
+			return;
+	}
+	hdr = shm_hdr;
+
+	/* begin write */
+	hdr->seq++;
+	__sync_synchronize();
+
+	hdr->max_pools = max;
+	statlist_for_each(item, &pool_list) {
+		fill_pool(pool_rec(hdr, n), container_of(item, PgPool, head), now);
+		n++;
+	}
+	hdr->pool_count = n;
+	hdr->update_time = now;
+
+	/* end write */
+	__sync_synchronize();
+	hdr->seq++;
+}
+
+/*
+ * Reader for "pgbouncer --shm-stats file".  Serves also as
+ * example for agents.
+ */
+
+static void *map_readonly(int fd, size_t *len_p)
+{
+	struct stat st;
+	void *ptr;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct ShmStatsHeader))
+		return NULL;
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
+	*len_p = st.st_size;
+	return ptr;
+}
+
+/* take consistent copy, returns malloc-ed buffer */
+static struct ShmStatsHeader *read_snapshot(int fd)
+{
+	const struct ShmStatsHeader *hdr;
+	struct ShmStatsHeader *copy = NULL;
+	size_t len = 0, need;
+	uint32_t seq;
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		hdr = map_readonly(fd, &len);
+		if (!hdr)
+			break;
+		seq = hdr->seq;
+		__sync_synchronize();
+		need = hdr->header_size + (size_t)hdr->max_pools * hdr->pool_size;
+		if (hdr->magic != SHMSTATS_MAGIC || hdr->version != SHMSTATS_VERSION) {
+			munmap((void *)hdr, len);
+			break;
+		}
+		if ((seq & 1) == 0 && need <= len) {
+			free(copy);
+			copy = malloc(need);
+			if (copy)
+				memcpy(copy, hdr, need);
+			__sync_synchronize();
+			if (copy && hdr->seq == seq) {
+				munmap((void *)hdr, len);
+				return copy;
+			}
+		}
+		munmap((void *)hdr, len);
+		usleep(1000);
+	}
+	free(copy);
+	return NULL;
+}
+
+bool shmstats_show(const char *fn)
+{
+	struct ShmStatsHeader *hdr;
+	struct ShmStatsPool *p;
+	unsigned i;
+	int fd;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+		return false;
+	}
+	hdr = read_snapshot(fd);
+	close(fd);
+	if (!hdr) {
+		fprintf(stderr, "%s: not a stats file or unsupported version\n", fn);
+		return false;
+	}
+
+	printf("pid %u, updated %" PRIu64 ", %u pools\n",
+	       hdr->pid, (uint64_t)hdr->update_time, hdr->pool_count);
+	printf("%-20s %-16s %9s %9s %9s %9s %9s %14s %14s %14s %14s %10s\n",
+	       "database", "user", "cl_active", "cl_wait", "sv_active", "sv_idle",
+	       "sv_login", "requests", "recv", "sent", "query_us", "maxwait_us");
+	for (i = 0; i < hdr->pool_count; i++) {
+		p = pool_rec(hdr, i);
+		printf("%-20s %-16s %9u %9u %9u %9u %9u %14" PRIu64 " %14" PRIu64
+		       " %14" PRIu64 " %14" PRIu64 " %10" PRIu64 "\n",
+		       p->database, p->user, p->cl_active, p->cl_waiting,
+		       p->sv_active, p->sv_idle, p->sv_login, p->request_count,
+		       p->client_bytes, p->server_bytes, p->query_time, p->maxwait);
+	}
+	free(hdr);
+	return true;
+}
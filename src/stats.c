@@ -21,12 +21,40 @@
 static struct event ev_stats;
 static usec_t old_stamp, new_stamp;
 
+/*
+ * Short-term history for SHOW STATS <window>.  Each second all pools
+ * copy their stats into ring of snapshots.  Further in past the step
+ * gets coarser, so 24 snapshots per pool cover 300 seconds.  Averages
+ * are calculated against newest snapshot that is at least window
+ * seconds old, so long windows may be up to one step longer.
+ */
+struct HistLevel {
+	unsigned step;		/* seconds between snapshots */
+	unsigned slots;
+	unsigned offset;	/* first slot in stats_hist */
+};
+
+static const struct HistLevel hist_levels[] = {
+	{ 1, 11, 0 },
+	{ 10, 7, 11 },
+	{ 60, 6, 18 },
+};
+#define HIST_LEVELS (int)(sizeof(hist_levels) / sizeof(hist_levels[0]))
+
+static struct event ev_hist;
+static unsigned hist_tick;
+static usec_t hist_time[STATS_HIST_LEN];	/* 0 if slot is unused */
+
 static void reset_stats(PgStats *stat)
 {
 	stat->server_bytes = 0;
 	stat->client_bytes = 0;
 	stat->request_count = 0;
 	stat->query_time = 0;
+	stat->xact_count = 0;
+	stat->query_count = 0;
+	stat->xact_time = 0;
+	stat->wait_time = 0;
 }
 
 static void stat_add(PgStats *total, PgStats *stat)
@@ -35,12 +63,15 @@ static void stat_add(PgStats *total, PgStats *stat)
 	total->client_bytes += stat->client_bytes;
 	total->request_count += stat->request_count;
 	total->query_time += stat->query_time;
+	total->xact_count += stat->xact_count;
+	total->query_count += stat->query_count;
+	total->xact_time += stat->xact_time;
+	total->wait_time += stat->wait_time;
 }
 
-static void calc_average(PgStats *avg, PgStats *cur, PgStats *old)
+static void calc_average(PgStats *avg, PgStats *cur, PgStats *old, usec_t dur)
 {
-	uint64_t qcount;
-	usec_t dur = get_cached_time() - old_stamp;
+	uint64_t qcount, xcount;
 
 	reset_stats(avg);
 
@@ -50,29 +81,92 @@ static void calc_average(PgStats *avg, PgStats *cur, PgStats *old)
 	avg->request_count = USEC * (cur->request_count - old->request_count) / dur;
 	avg->client_bytes = USEC * (cur->client_bytes - old->client_bytes) / dur;
 	avg->server_bytes = USEC * (cur->server_bytes - old->server_bytes) / dur;
+	avg->xact_count = USEC * (cur->xact_count - old->xact_count) / dur;
+	avg->query_count = USEC * (cur->query_count - old->query_count) / dur;
+	avg->wait_time = USEC * (cur->wait_time - old->wait_time) / dur;
 	qcount = cur->request_count - old->request_count;
 	if (qcount > 0)
 		avg->query_time = (cur->query_time - old->query_time) / qcount;
+	xcount = cur->xact_count - old->xact_count;
+	if (xcount > 0)
+		avg->xact_time = (cur->xact_time - old->xact_time) / xcount;
+}
+
+#define STATS_FMT "sqqqqqqqqqqqqqqqq"
+
+static void write_header(PktBuf *buf, const char *name)
+{
+	pktbuf_write_RowDescription(buf, STATS_FMT, name,
+				    "total_requests", "total_received",
+				    "total_sent", "total_query_time",
+				    "avg_req", "avg_recv", "avg_sent",
+				    "avg_query",
+				    "total_xact_count", "total_query_count",
+				    "total_xact_time", "total_wait_time",
+				    "avg_xact_count", "avg_query_count",
+				    "avg_xact_time", "avg_wait_time");
+}
+
+/* pick snapshot for averages, -1 means last stats_period */
+static int hist_slot(int window)
+{
+	usec_t limit = get_cached_time() - window * USEC;
+	int i, slot = -1;
+
+	if (window <= 0)
+		return -1;
+	for (i = 0; i < STATS_HIST_LEN; i++) {
+		if (!hist_time[i] || hist_time[i] > limit)
+			continue;
+		if (slot < 0 || hist_time[i] > hist_time[slot])
+			slot = i;
+	}
+	if (slot >= 0)
+		return slot;
+
+	/* not running long enough, take oldest */
+	for (i = 0; i < STATS_HIST_LEN; i++) {
+		if (!hist_time[i])
+			continue;
+		if (slot < 0 || hist_time[i] < hist_time[slot])
+			slot = i;
+	}
+	return slot;
+}
+
+static PgStats *old_stats(PgPool *pool, int slot)
+{
+	return slot < 0 ? &pool->older_stats : &pool->stats_hist[slot];
+}
+
+static usec_t old_duration(int slot)
+{
+	return get_cached_time() - (slot < 0 ? old_stamp : hist_time[slot]);
 }
 
-static void write_stats(PktBuf *buf, PgStats *stat, PgStats *old, char *dbname)
+static void write_stats(PktBuf *buf, PgStats *stat, PgStats *old, int slot, const char *name)
 {
 	PgStats avg;
-	calc_average(&avg, stat, old);
-	pktbuf_write_DataRow(buf, "sqqqqqqqq", dbname,
+	calc_average(&avg, stat, old, old_duration(slot));
+	pktbuf_write_DataRow(buf, STATS_FMT, name,
 			     stat->request_count, stat->client_bytes,
 			     stat->server_bytes, stat->query_time,
 			     avg.request_count, avg.client_bytes,
-			     avg.server_bytes, avg.query_time);
+			     avg.server_bytes, avg.query_time,
+			     stat->xact_count, stat->query_count,
+			     stat->xact_time, stat->wait_time,
+			     avg.xact_count, avg.query_count,
+			     avg.xact_time, avg.wait_time);
 }
 
-bool admin_database_stats(PgSocket *client, StatList *pool_list)
+bool admin_database_stats(PgSocket *client, StatList *pool_list, int window)
 {
 	PgPool *pool;
 	List *item;
 	PgDatabase *cur_db = NULL;
 	PgStats st_total, st_db, old_db, old_total;
 	int rows = 0;
+	int slot = hist_slot(window);
 	PktBuf *buf;
 
 	reset_stats(&st_total);
@@ -86,11 +180,7 @@ bool admin_database_stats(PgSocket *client, StatList *pool_list)
 		return true;
 	}
 
-	pktbuf_write_RowDescription(buf, "sqqqqqqqq", "database",
-				    "total_requests", "total_received",
-				    "total_sent", "total_query_time",
-				    "avg_req", "avg_recv", "avg_sent",
-				    "avg_query");
+	write_header(buf, "database");
 	statlist_for_each(item, pool_list) {
 		pool = container_of(item, PgPool, head);
 
@@ -98,7 +188,7 @@ bool admin_database_stats(PgSocket *client, StatList *pool_list)
 			cur_db = pool->db;
 
 		if (pool->db != cur_db) {
-			write_stats(buf, &st_db, &old_db, cur_db->name);
+			write_stats(buf, &st_db, &old_db, slot, cur_db->name);
 
 			rows ++;
 			cur_db = pool->db;
@@ -109,10 +199,10 @@ bool admin_database_stats(PgSocket *client, StatList *pool_list)
 		}
 
 		stat_add(&st_db, &pool->stats);
-		stat_add(&old_db, &pool->older_stats);
+		stat_add(&old_db, old_stats(pool, slot));
 	}
 	if (cur_db) {
-		write_stats(buf, &st_db, &old_db, cur_db->name);
+		write_stats(buf, &st_db, &old_db, slot, cur_db->name);
 		stat_add(&st_total, &st_db);
 		stat_add(&old_total, &old_db);
 		rows ++;
@@ -122,11 +212,85 @@ bool admin_database_stats(PgSocket *client, StatList *pool_list)
 	return true;
 }
 
-bool show_stat_totals(PgSocket *client, StatList *pool_list)
+/* sum stats of all pools where given user is logged in */
+/* sum pools by user name, forced users of databases may share it */
+static void write_user_stats(PktBuf *buf, const char *name, int slot)
+{
+	PgPool *pool;
+	List *item;
+	PgStats st_user, old_user;
+	bool found = false;
+
+	reset_stats(&st_user);
+	reset_stats(&old_user);
+	statlist_for_each(item, &pool_list) {
+		pool = container_of(item, PgPool, head);
+		if (strcmp(pool->user->name, name) != 0)
+			continue;
+		stat_add(&st_user, &pool->stats);
+		stat_add(&old_user, old_stats(pool, slot));
+		found = true;
+	}
+	if (found)
+		write_stats(buf, &st_user, &old_user, slot, name);
+}
+
+/* is forced user's name shown already as user or for earlier database */
+static bool forced_user_shown(PgDatabase *db)
+{
+	const char *name = db->forced_user->name;
+	PgDatabase *prev;
+	List *item;
+
+	if (find_user(name))
+		return true;
+	statlist_for_each(item, &database_list) {
+		prev = container_of(item, PgDatabase, head);
+		if (prev == db)
+			break;
+		if (prev->forced_user && strcmp(prev->forced_user->name, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+bool admin_user_stats(PgSocket *client, StatList *user_list, int window)
+{
+	PgDatabase *db;
+	PgUser *user;
+	List *item;
+	int slot = hist_slot(window);
+	PktBuf *buf;
+
+	buf = pktbuf_dynamic(512);
+	if (!buf) {
+		admin_error(client, "no mem");
+		return true;
+	}
+
+	write_header(buf, "user");
+	statlist_for_each(item, user_list) {
+		user = container_of(item, PgUser, head);
+		write_user_stats(buf, user->name, slot);
+	}
+
+	/* forced users are not in user_list */
+	statlist_for_each(item, &database_list) {
+		db = container_of(item, PgDatabase, head);
+		if (db->forced_user && !forced_user_shown(db))
+			write_user_stats(buf, db->forced_user->name, slot);
+	}
+	admin_flush(client, buf, "SHOW");
+
+	return true;
+}
+
+bool show_stat_totals(PgSocket *client, StatList *pool_list, int window)
 {
 	PgPool *pool;
 	List *item;
 	PgStats st_total, old_total, avg;
+	int slot = hist_slot(window);
 	PktBuf *buf;
 
 	reset_stats(&st_total);
@@ -142,10 +306,10 @@ bool show_stat_totals(PgSocket *client, StatList *pool_list)
 	statlist_for_each(item, pool_list) {
 		pool = container_of(item, PgPool, head);
 		stat_add(&st_total, &pool->stats);
-		stat_add(&old_total, &pool->older_stats);
+		stat_add(&old_total, old_stats(pool, slot));
 	}
 
-	calc_average(&avg, &st_total, &old_total);
+	calc_average(&avg, &st_total, &old_total, old_duration(slot));
 
 	pktbuf_write_RowDescription(buf, "sq", "name", "value");
 
@@ -156,10 +320,18 @@ bool show_stat_totals(PgSocket *client, StatList *pool_list)
 	WTOTAL(client_bytes);
 	WTOTAL(server_bytes);
 	WTOTAL(query_time);
+	WTOTAL(xact_count);
+	WTOTAL(query_count);
+	WTOTAL(xact_time);
+	WTOTAL(wait_time);
 	WAVG(request_count);
 	WAVG(client_bytes);
 	WAVG(server_bytes);
 	WAVG(query_time);
+	WAVG(xact_count);
+	WAVG(query_count);
+	WAVG(xact_time);
+	WAVG(wait_time);
 
 	admin_flush(client, buf, "SHOW");
 	return true;
@@ -186,18 +358,80 @@ static void refresh_stats(int s, short flags, void *arg)
 		stat_add(&cur_total, &pool->stats);
 		stat_add(&old_total, &pool->older_stats);
 	}
-	calc_average(&avg, &cur_total, &old_total);
+	calc_average(&avg, &cur_total, &old_total, new_stamp - old_stamp);
 	/* send totals to logfile */
 	log_info("Stats: %" PRIu64 " req/s,"
+		 " %" PRIu64 " xact/s,"
 		 " in %" PRIu64 " b/s,"
 		 " out %" PRIu64 " b/s,"
-		 "query %" PRIu64 " us",
-		 avg.request_count, avg.client_bytes,
-		 avg.server_bytes, avg.query_time);
+		 " query %" PRIu64 " us,"
+		 " xact %" PRIu64 " us,"
+		 " wait %" PRIu64 " us/s",
+		 avg.request_count, avg.xact_count,
+		 avg.client_bytes, avg.server_bytes,
+		 avg.query_time, avg.xact_time, avg.wait_time);
 
 	safe_evtimer_add(&ev_stats, &period);
 }
 
+/* take snapshot for every level whose step is due */
+static void stats_tick(int s, short flags, void *arg)
+{
+	struct timeval period = { 1, 0 };
+	const struct HistLevel *lv;
+	int slots[HIST_LEVELS];
+	int i, n = 0;
+	usec_t now = get_cached_time();
+	List *item;
+	PgPool *pool;
+
+	for (i = 0; i < HIST_LEVELS; i++) {
+		lv = &hist_levels[i];
+		if (hist_tick % lv->step)
+			continue;
+		slots[n] = lv->offset + (hist_tick / lv->step) % lv->slots;
+		hist_time[slots[n]] = now;
+		n++;
+	}
+	hist_tick++;
+
+	statlist_for_each(item, &pool_list) {
+		pool = container_of(item, PgPool, head);
+		for (i = 0; i < n; i++)
+			pool->stats_hist[slots[i]] = pool->stats;
+	}
+
+	safe_evtimer_add(&ev_hist, &period);
+}
+
+/*
+ * Log client whose wait or query took too long.  Limited to
+ * log_slow_limit messages per second, rest are only counted.
+ */
+void log_slow(PgSocket *client, const char *what, usec_t dur)
+{
+	static usec_t period_start;
+	static int count, suppressed;
+	usec_t now = get_cached_time();
+
+	if (now - period_start >= USEC) {
+		if (suppressed > 0)
+			log_info("%d slow query/wait messages suppressed", suppressed);
+		period_start = now;
+		count = 0;
+		suppressed = 0;
+	}
+	if (cf_log_slow_limit > 0 && count >= cf_log_slow_limit) {
+		suppressed++;
+		return;
+	}
+	count++;
+
+	slog_info(client, "slow %s: %" PRIu64 " ms, query: %s", what,
+		  (uint64_t)(dur / 1000),
+		  client->query_text[0] ? client->query_text : "(unknown)");
+}
+
 void stats_setup(void)
 {
 	struct timeval period = { cf_stats_period, 0 };
@@ -208,5 +442,9 @@ void stats_setup(void)
 	/* launch stats */
 	evtimer_set(&ev_stats, refresh_stats, NULL);
 	safe_evtimer_add(&ev_stats, &period);
+
+	/* launch history, first snapshot right now */
+	evtimer_set(&ev_hist, stats_tick, NULL);
+	stats_tick(0, 0, NULL);
 }
 
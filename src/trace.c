@@ -0,0 +1,212 @@
+/*
+ * PgBouncer - Lightweight connection pooler for PostgreSQL.
+ * 
+ * Copyright (c) 2007-2009  Marko Kreen, Skype Technologies OÜ
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Binary trace of socket events.
+ *
+ * Each event seen by client_proto() and server_proto() is stored as
+ * fixed-size entry in ring, without any formatting.  Contents can be
+ * seen with SHOW TRACE or written to trace_file with TRACE DUMP.
+ */
+
+#include "bouncer.h"
+
+/* entries, rounded up to power of 2, 0 disables */
+#define TRACE_MAX_SIZE	(1 << 24)
+
+/* SHOW TRACE without argument, whole ring is for TRACE DUMP */
+#define TRACE_SHOW_DEFAULT	100
+
+struct TraceEntry *trace_ring;
+unsigned trace_mask;
+unsigned trace_pos;
+
+static unsigned trace_size;
+
+static const char *event_names[] = {
+	"read",
+	"recv_failed",
+	"send_failed",
+	"connect_failed",
+	"connect_ok",
+	"flush",
+	"pkt_callback",
+};
+#define N_EVENTS (sizeof(event_names) / sizeof(event_names[0]))
+
+/* (re)allocate ring if trace_size changed */
+void trace_setup(void)
+{
+	unsigned size = 0;
+
+	if (cf_trace_size > 0) {
+		size = 1;
+		while (size < (unsigned)cf_trace_size && size < TRACE_MAX_SIZE)
+			size <<= 1;
+	}
+	if (size == trace_size)
+		return;
+
+	free(trace_ring);
+	trace_ring = NULL;
+	trace_mask = 0;
+	trace_pos = 0;
+	trace_size = 0;
+	if (!size) {
+		log_info("trace disabled");
+		return;
+	}
+
+	trace_ring = calloc(size, sizeof(*trace_ring));
+	if (!trace_ring) {
+		log_error("trace: no mem for %u entries", size);
+		return;
+	}
+	trace_size = size;
+	trace_mask = size - 1;
+	log_info("trace enabled, %u entries", size);
+}
+
+static unsigned trace_count(void)
+{
+	return trace_pos < trace_size ? trace_pos : trace_size;
+}
+
+static struct TraceEntry *trace_entry(unsigned pos)
+{
+	return &trace_ring[pos & trace_mask];
+}
+
+/* Command: SHOW TRACE [n] - last n events, oldest first */
+bool admin_show_trace(PgSocket *admin, const char *arg)
+{
+	struct TraceEntry *e;
+	unsigned i, n = trace_count();
+	const char *ev;
+	char ptr[32], type[2];
+	char *end;
+	long val = TRACE_SHOW_DEFAULT;
+	PktBuf *buf;
+
+	if (arg) {
+		val = strtol(arg, &end, 10);
+		if (*end || val < 1)
+			return admin_error(admin, "bad argument: %s", arg);
+	}
+	if ((unsigned long)val < n)
+		n = val;
+
+	buf = pktbuf_dynamic(256);
+	if (!buf) {
+		admin_error(admin, "no mem");
+		return true;
+	}
+
+	pktbuf_write_RowDescription(buf, "Tqssssi", "time", "usec", "ptr",
+				    "side", "event", "type", "len");
+	for (i = trace_pos - n; i != trace_pos; i++) {
+		e = trace_entry(i);
+		ev = e->event < N_EVENTS ? event_names[e->event] : "?";
+		snprintf(ptr, sizeof(ptr), "%p", (void *)(uintptr_t)e->sock);
+		type[0] = e->pkt_type;
+		type[1] = 0;
+		pktbuf_write_DataRow(buf, "Tqssssi", e->time, e->time, ptr,
+				     e->side == 'S' ? "S" : "C", ev,
+				     type, e->len);
+	}
+	admin_flush(admin, buf, "SHOW");
+	return true;
+}
+
+static bool write_entries(int fd, unsigned idx, unsigned n)
+{
+	size_t len = (size_t)n * sizeof(struct TraceEntry);
+	return write(fd, &trace_ring[idx], len) == (ssize_t)len;
+}
+
+/*
+ * trace_file is settable from console, so existing files are never
+ * overwritten.  Contents go to new temp file that is then linked
+ * to final name, which fails if it exists.
+ */
+static bool trace_dump(PgSocket *admin)
+{
+	struct TraceFileHeader hdr;
+	unsigned n = trace_count();
+	unsigned first = (trace_pos - n) & trace_mask;
+	char tmp_fn[PATH_MAX];
+	int fd;
+	bool ok;
+
+	if (!*cf_trace_file)
+		return admin_error(admin, "trace_file is not set");
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	hdr.entry_size = sizeof(struct TraceEntry);
+	hdr.count = n;
+
+	snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", cf_trace_file);
+	fd = open(tmp_fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		return admin_error(admin, "%s: %s", tmp_fn, strerror(errno));
+
+	/* ring may wrap, so write in two parts */
+	ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+	if (ok && first + n > trace_size) {
+		ok = write_entries(fd, first, trace_size - first);
+		n -= trace_size - first;
+		first = 0;
+	}
+	if (ok && n > 0)
+		ok = write_entries(fd, first, n);
+	if (close(fd) < 0)
+		ok = false;
+	if (!ok) {
+		unlink(tmp_fn);
+		return admin_error(admin, "%s: write failed", tmp_fn);
+	}
+	if (link(tmp_fn, cf_trace_file) < 0) {
+		int err = errno;
+		unlink(tmp_fn);
+		return admin_error(admin, "%s: %s", cf_trace_file, strerror(err));
+	}
+	unlink(tmp_fn);
+
+	log_info("trace: %" PRIu64 " events written to %s",
+		 (uint64_t)hdr.count, cf_trace_file);
+	return admin_ready(admin, "TRACE");
+}
+
+/* Command: TRACE DUMP|CLEAR */
+bool admin_cmd_trace(PgSocket *admin, const char *arg)
+{
+	if (!admin->admin_user)
+		return admin_error(admin, "admin access needed");
+	if (!trace_ring)
+		return admin_error(admin, "trace is disabled");
+
+	if (strcasecmp(arg, "dump") == 0)
+		return trace_dump(admin);
+	if (strcasecmp(arg, "clear") == 0) {
+		trace_pos = 0;
+		return admin_ready(admin, "TRACE");
+	}
+	return admin_error(admin, "syntax error, use TRACE DUMP|CLEAR");
+}
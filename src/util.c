@@ -384,11 +384,37 @@ loop:
 	return res;
 }
 
+/*
+ * Returned socket is already non-blocking and close-on-exec.
+ *
+ * With accept4() that happens in same syscall, otherwise fcntl()
+ * is done here.
+ */
 int safe_accept(int fd, struct sockaddr *sa, socklen_t *sa_len_p)
 {
 	int res;
+#ifdef HAVE_ACCEPT4
+	static bool accept4_missing = false;
+#endif
 loop:
-	res = accept(fd, sa, sa_len_p);
+#ifdef HAVE_ACCEPT4
+	if (!accept4_missing) {
+		res = accept4(fd, sa, sa_len_p, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (res < 0 && errno == ENOSYS) {
+			/* libc has it, kernel does not */
+			accept4_missing = true;
+			goto loop;
+		}
+	} else
+#endif
+	{
+		res = accept(fd, sa, sa_len_p);
+		if (res >= 0) {
+			if (fcntl(res, F_SETFD, FD_CLOEXEC) < 0)
+				fatal_perror("fcntl FD_CLOEXEC");
+			socket_set_nonblocking(res, 1);
+		}
+	}
 	if (res < 0 && errno == EINTR)
 		goto loop;
 	if (res < 0)
@@ -484,7 +510,7 @@ void get_random_bytes(uint8_t *dest, int len)
  * high-precision time
  */
 
-static usec_t get_time_usec(void)
+usec_t get_time_usec(void)
 {
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
@@ -529,6 +555,52 @@ void socket_set_nonblocking(int fd, int val)
 		fatal_perror("fcntl(F_SETFL)");
 }
 
+/*
+ * Set needed options on socket from safe_accept().
+ *
+ * Linux copies socket options from listening socket to accepted
+ * one, so when listening socket is tuned nothing is left to do.
+ */
+void tune_accepted_socket(int sock, bool is_unix)
+{
+#ifndef __linux__
+	tune_socket(sock, is_unix);
+#endif
+}
+
+/* keepalive options have been set on some socket */
+static bool keepalive_tuned = false;
+
+#ifdef __linux__
+/*
+ * Set TCP keepalive option, value 0 means system default.
+ * The default needs to be set only if socket may have
+ * inherited other value.
+ */
+static void set_keepalive_opt(int sock, int opt, int val, const char *sysctl)
+{
+	char fn[128];
+	FILE *f;
+	int res;
+
+	if (val <= 0) {
+		if (!keepalive_tuned)
+			return;
+		snprintf(fn, sizeof(fn), "/proc/sys/net/ipv4/%s", sysctl);
+		f = fopen(fn, "r");
+		if (!f)
+			return;
+		res = fscanf(f, "%d", &val);
+		fclose(f);
+		if (res != 1 || val <= 0)
+			return;
+	}
+	res = setsockopt(sock, IPPROTO_TCP, opt, &val, sizeof(val));
+	if (res < 0)
+		fatal_perror("setsockopt TCP_KEEP*");
+}
+#endif
+
 /* set needed socket options */
 void tune_socket(int sock, bool is_unix)
 {
@@ -557,35 +629,28 @@ void tune_socket(int sock, bool is_unix)
 	if (is_unix)
 		return;
 
-	/* the keepalive stuff needs some poking before enbling */
-	if (cf_tcp_keepalive) {
-		/* turn on socket keepalive */
-		val = 1;
+	/*
+	 * The keepalive stuff needs some poking before enbling.
+	 *
+	 * Listening socket passes its options to accepted sockets and
+	 * is re-tuned on reload, so settings turned off after being
+	 * used must be reset explicitly.
+	 */
+	if (cf_tcp_keepalive || keepalive_tuned) {
+		/* turn on/off socket keepalive */
+		val = cf_tcp_keepalive ? 1 : 0;
 		res = setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
 		if (res < 0)
 			fatal_perror("setsockopt SO_KEEPALIVE");
+	}
+	if (cf_tcp_keepalive) {
 #ifdef __linux__
 		/* set count of keepalive packets */
-		if (cf_tcp_keepcnt > 0) {
-			val = cf_tcp_keepcnt;
-			res = setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val));
-			if (res < 0)
-				fatal_perror("setsockopt TCP_KEEPCNT");
-		}
+		set_keepalive_opt(sock, TCP_KEEPCNT, cf_tcp_keepcnt, "tcp_keepalive_probes");
 		/* how long the connection can stay idle before sending keepalive pkts */
-		if (cf_tcp_keepidle) {
-			val = cf_tcp_keepidle;
-			res = setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &val, sizeof(val));
-			if (res < 0)
-				fatal_perror("setsockopt TCP_KEEPIDLE");
-		}
+		set_keepalive_opt(sock, TCP_KEEPIDLE, cf_tcp_keepidle, "tcp_keepalive_time");
 		/* time between packets */
-		if (cf_tcp_keepintvl) {
-			val = cf_tcp_keepintvl;
-			res = setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &val, sizeof(val));
-			if (res < 0)
-				fatal_perror("setsockopt TCP_KEEPINTVL");
-		}
+		set_keepalive_opt(sock, TCP_KEEPINTVL, cf_tcp_keepintvl, "tcp_keepalive_intvl");
 #else
 #ifdef TCP_KEEPALIVE
 		if (cf_tcp_keepidle) {
@@ -596,6 +661,7 @@ void tune_socket(int sock, bool is_unix)
 		}
 #endif
 #endif
+		keepalive_tuned = true;
 	}
 
 	/* set in-kernel socket buffer size */
@@ -656,6 +722,74 @@ loop:
 	return true;
 }
 
+/*
+ * Canonical form of query text for exact matching: lowercase,
+ * whitespace runs as single space, no leading or trailing
+ * whitespace or semicolons.  Quoted literals and identifiers are
+ * kept as-is, after '$' the rest is kept as-is as it may be
+ * dollar-quoted.  Returns length, -1 if does not fit.
+ */
+int normalize_query(char *dst, int dstlen, const char *src, int srclen)
+{
+	const char *end = src + srclen;
+	bool space = false;
+	char quote = 0;
+	int keep = 0;
+	int len = 0;
+	char c;
+
+	while (src < end && *src && (isspace((unsigned char)*src) || *src == ';'))
+		src++;
+	for (; src < end && *src; src++) {
+		c = *src;
+		if (!quote && isspace((unsigned char)c)) {
+			space = true;
+			continue;
+		}
+		if (len + 3 >= dstlen)
+			return -1;
+		if (space && len > 0)
+			dst[len++] = ' ';
+		space = false;
+		if (quote) {
+			if (c == quote && quote != '$')
+				quote = 0;
+			else if (c == '\\' && src + 1 < end && src[1])
+				dst[len++] = *src++;
+			dst[len++] = *src;
+			keep = len;
+		} else if (c == '\'' || c == '"' || c == '$') {
+			quote = c;
+			dst[len++] = c;
+			keep = len;
+		} else {
+			dst[len++] = tolower((unsigned char)c);
+		}
+	}
+	while (len > keep && (dst[len - 1] == ';' || dst[len - 1] == ' '))
+		len--;
+	dst[len] = 0;
+	return len;
+}
+
+/* is normalized query an entry in ';'-separated list */
+bool querylist_contains(const char *list, const char *q)
+{
+	const char *p, *next;
+	int len = strlen(q);
+
+	for (p = list; *p; p = next) {
+		next = strchr(p, ';');
+		if (!next)
+			next = p + strlen(p);
+		if (next - p == len && memcmp(p, q, len) == 0)
+			return true;
+		if (*next)
+			next++;
+	}
+	return false;
+}
+
 const char *format_date(usec_t uval)
 {
 	static char buf[128];
@@ -712,6 +846,20 @@ void fill_local_addr(PgSocket *sk, int fd, bool is_unix)
 	}
 }
 
+/*
+ * Clients from wildcard listener have local address
+ * looked up only when it is actually needed.
+ */
+const PgAddr *get_local_addr(PgSocket *sk)
+{
+	PgAddr *addr = &sk->local_addr;
+
+	if (!addr->is_unix && addr->ip_addr.s_addr == INADDR_ANY
+	    && sbuf_socket(&sk->sbuf) > 0)
+		fill_local_addr(sk, sbuf_socket(&sk->sbuf), false);
+	return addr;
+}
+
 /*
  * Error handling around evtimer_add() is nasty as the code
  * may not be called again.  As there is fixed number of timers
@@ -26,6 +26,7 @@ struct var_lookup {
 	const char *name;
 	int offset;
 	int len;
+	bool local;	/* not reported by server, set only by pooler */
 };
 
 static const struct var_lookup lookup [] = {
@@ -33,6 +34,7 @@ static const struct var_lookup lookup [] = {
  {"datestyle",                   offsetof(VarCache, datestyle),       VAR_DATESTYLE_LEN },
  {"timezone",                    offsetof(VarCache, timezone),        VAR_TIMEZONE_LEN },
  {"standard_conforming_strings", offsetof(VarCache, std_strings),     VAR_STDSTR_LEN },
+ {"default_transaction_read_only", offsetof(VarCache, read_only),     VAR_READONLY_LEN, true },
  {NULL},
 };
 
@@ -41,7 +43,7 @@ static inline char *get_value(VarCache *cache, const struct var_lookup *lk)
 	return (char *)(cache) + lk->offset;
 }
 
-bool varcache_set(VarCache *cache, const char *key, const char *value)
+static bool set_var(VarCache *cache, const char *key, const char *value, bool local)
 {
 	int vlen;
 	char *pos;
@@ -52,7 +54,7 @@ bool varcache_set(VarCache *cache, const char *key, const char *value)
 		value = "";
 
 	for (lk = lookup; lk->name; lk++) {
-		if (strcasecmp(lk->name, key) != 0)
+		if (lk->local != local || strcasecmp(lk->name, key) != 0)
 			continue;
 
 		vlen = strlen(value);
@@ -68,6 +70,21 @@ bool varcache_set(VarCache *cache, const char *key, const char *value)
 	return false;
 }
 
+/* parameter reported by server */
+bool varcache_set(VarCache *cache, const char *key, const char *value)
+{
+	return set_var(cache, key, value, false);
+}
+
+/*
+ * Parameter server does not report, so server side value
+ * is tracked by pooler.  Only some databases accept it from client.
+ */
+bool varcache_set_local(VarCache *cache, const char *key, const char *value)
+{
+	return set_var(cache, key, value, true);
+}
+
 static bool is_std_quote(VarCache *vars)
 {
 	const char *val = vars->std_strings;
@@ -99,10 +116,11 @@ static bool quote_literal(char *buf, int buflen, const char *src, bool std_quote
 	return true;
 }
 
-static int apply_var(PktBuf *pkt, const char *key,
+static int apply_var(PktBuf *pkt, const struct var_lookup *lk,
 		     const char *cval, const char *sval,
 		     bool std_quote)
 {
+	const char *key = lk->name;
 	char buf[128];
 	char qbuf[128];
 	unsigned len;
@@ -110,6 +128,13 @@ static int apply_var(PktBuf *pkt, const char *key,
 	if (strcasecmp(cval, sval) == 0)
 		return 0;
 
+	/* local var left by previous client goes back to default */
+	if (!*cval && lk->local) {
+		len = snprintf(buf, sizeof(buf), "SET %s=DEFAULT;", key);
+		pktbuf_put_bytes(pkt, buf, len);
+		return 1;
+	}
+
 	/* if unset, ignore */
 	if (!*cval)
 		return 0;
@@ -148,7 +173,12 @@ bool varcache_apply(PgSocket *server, PgSocket *client, bool *changes_p)
 	for (lk = lookup; lk->name; lk++) {
 		sval = get_value(&server->vars, lk);
 		cval = get_value(&client->vars, lk);
-		changes += apply_var(&pkt, lk->name, cval, sval, std_quote);
+		if (apply_var(&pkt, lk, cval, sval, std_quote)) {
+			changes++;
+			/* no ParameterStatus will come for it */
+			if (lk->local)
+				memcpy(get_value(&server->vars, lk), cval, lk->len);
+		}
 	}
 	*changes_p = changes > 0;
 	if (!changes)
@@ -166,6 +196,8 @@ void varcache_fill_unset(VarCache *src, PgSocket *dst)
 	char *srcval, *dstval;
 	const struct var_lookup *lk;
 	for (lk = lookup; lk->name; lk++) {
+		if (lk->local)
+			continue;
 		srcval = get_value(src, lk);
 		dstval = get_value(&dst->vars, lk);
 		if (!*dstval)
@@ -179,6 +211,17 @@ void varcache_clean(VarCache *cache)
 	cache->datestyle[0] = 0;
 	cache->timezone[0] = 0;
 	cache->std_strings[0] = 0;
+	cache->read_only[0] = 0;
+}
+
+/* server went back to defaults, forget values set by pooler */
+void varcache_clean_local(VarCache *cache)
+{
+	const struct var_lookup *lk;
+	for (lk = lookup; lk->name; lk++) {
+		if (lk->local)
+			get_value(cache, lk)[0] = 0;
+	}
 }
 
 void varcache_add_params(PktBuf *pkt, VarCache *vars)
@@ -186,6 +229,8 @@ void varcache_add_params(PktBuf *pkt, VarCache *vars)
 	char *val;
 	const struct var_lookup *lk;
 	for (lk = lookup; lk->name; lk++) {
+		if (lk->local)
+			continue;
 		val = get_value(vars, lk);
 		if (*val)
 			pktbuf_write_ParameterStatus(pkt, lk->name, val);
@@ -149,6 +149,43 @@ test_query_timeout() {
 	return 0
 }
 
+# query_wait_timeout
+test_query_wait_timeout() {
+	# p0 has pool_size=2, third client has to wait
+	for i in 1 2; do
+		psql -c "select pg_sleep(6)" p0 &
+	done
+	sleep 1
+	psql -c "select now() as waiting" p0 &
+	sleep 1
+
+	# must apply to client already waiting
+	admin "set query_wait_timeout=2"
+	sleep 3
+	grep "closing because: query_wait_timeout" $BOUNCER_LOG
+	rc=$?
+	wait
+	return $rc
+}
+
+# statement pooling: transactions are refused or rolled back
+test_statement_tx() {
+	# explicit BEGIN is refused, connection stays usable
+	psql p0 >$LOGDIR/test.tmp 2>&1 <<-PSQL_EOF
+	begin;
+	select 1 as still_ok;
+	PSQL_EOF
+	cat $LOGDIR/test.tmp
+	grep "Transactions not allowed in statement pooling mode" $LOGDIR/test.tmp || return 1
+	grep "still_ok" $LOGDIR/test.tmp || return 1
+
+	# transaction opened otherwise is rolled back on server
+	psql -c "select 1; begin" p0 2>&1 | grep "Long transactions not allowed" || return 1
+	psql -tAq -c "select 1 as after_rollback" p0 || return 1
+	grep "closing because: Long transactions not allowed" $BOUNCER_LOG && return 1
+	return 0
+}
+
 # client_idle_timeout
 test_client_idle_timeout() {
 	admin "set client_idle_timeout=2"
@@ -353,6 +390,46 @@ test_database_restart() {
 	psql p0 -c "select now() as p0_after_restart" || return 1
 }
 
+# host name is resolved via system resolver, so /etc/hosts works
+test_host_name() {
+	psql -tAq -c "select current_database()" p3 || return 1
+	admin "show hosts" | grep "localhost.*127.0.0.1" || return 1
+
+	# servers taken over by online restart stay attributed to host
+	psql -c "select now() as sleeping from pg_sleep(3)" p3 &
+	sleep 1
+	$BOUNCER_EXE -d -R $BOUNCER_INI
+	sleep 1
+	admin "show hosts" | grep "localhost.*127.0.0.1 *| *6666 *| *[1-9]"
+	rc=$?
+	wait
+	return $rc
+}
+
+# auth_query: users missing from auth_file are looked up from database
+test_auth_query() {
+	psql -p $PG_PORT p0 <<-PSQL_EOF
+	drop table if exists auth_users;
+	create table auth_users (usename text, passwd text);
+	insert into auth_users values ('quser', '');
+	grant select on auth_users to bouncer;
+	PSQL_EOF
+
+	admin "set auth_user = 'bouncer'"
+	admin "set auth_query = 'select usename, passwd from auth_users where usename=\$1'"
+	admin "set auth_cache_negative_ttl = 3"
+
+	psql -U quser -c "select now() as quser_login" p0 || return 1
+
+	# unknown user is remembered for auth_cache_negative_ttl
+	psql -U nuser -c "select now()" p0 && return 1
+	psql -p $PG_PORT -c "insert into auth_users values ('nuser', '')" p0
+	psql -U nuser -c "select now()" p0 && return 1
+	sleep 4
+	psql -U nuser -c "select now() as nuser_login" p0 || return 1
+	return 0
+}
+
 # test connect string change
 test_database_change() {
 	admin "set server_lifetime=2"
@@ -387,6 +464,8 @@ test_client_idle_timeout
 test_server_lifetime
 test_server_idle_timeout
 test_query_timeout
+test_query_wait_timeout
+test_statement_tx
 test_server_connect_timeout_establish
 test_server_connect_timeout_reject
 test_server_check_delay
@@ -397,6 +476,8 @@ test_pause_resume
 test_suspend_resume
 test_database_restart
 test_database_change
+test_host_name
+test_auth_query
 "
 
 if [ $# -gt 0 ]; then